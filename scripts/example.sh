@@ -10,6 +10,11 @@ echo -- Training vectors...
 time $BIN_DIR/WordVec -train $DATA_DIR -output $VECTOR_DATA -hidden_size 200 -window 5 -iter 2 -threads 4 -prefix text8_
   
 
+if [ -f $DATA_DIR/questions-words.txt ]; then
+  echo -- evaluating analogy accuracy...
+  $BIN_DIR/evaluate -model $VECTOR_DATA -analogy $DATA_DIR/questions-words.txt -threads 4
+fi
+
 echo -- calculate word distance...
 
 $BIN_DIR/distance $DATA_DIR/$VECTOR_DATA
@@ -0,0 +1,302 @@
+/*
+ * autotune.cc
+ */
+
+#include "autotune.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <omp.h>
+#include <sys/stat.h>
+
+#include "gflags/gflags.h"
+#include "input_stream.h"
+#include "utils.h"
+#include "wordvec.h"
+
+using namespace std;
+
+namespace {
+// candidates of max_sentence_size
+const int kSentenceSizes[] = {200, 1000, 5000};
+
+// words per reordered block when the reordered kernels are tried
+const int kReorderBlockWords = 10000;
+
+// candidates of shards per thread. The sample is far smaller than the
+// corpus, so the shard size is tuned as a share of the data per thread and
+// scaled to the corpus afterwards.
+const int kShardsPerThread[] = {1, 4, 16};
+
+// smallest shard of the sample, smaller ones only measure the scheduling
+const long long kMinSampleShard = 64LL << 10;
+
+inline bool IsSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+}
+
+Autotuner::Autotuner(const vector<string> &files, const Options &options,
+                     long long sample_bytes, const string &work_dir)
+    : files_(files), options_(options), sample_bytes_(sample_bytes),
+      work_dir_(work_dir), best_speed_(0) {
+  // bursts count their own vocabulary and write nothing
+  options_.read_vocab_file.clear();
+  options_.save_vocab_file.clear();
+  options_.mapped_model_file.clear();
+  options_.iter = 1;
+}
+
+Autotuner::~Autotuner() {
+  for (const auto &file : sample_files_) {
+    remove(file.c_str());
+  }
+  if (!vocab_file_.empty()) {
+    remove(vocab_file_.c_str());
+  }
+}
+
+// Copy the head of every training file, decompressed, cut after the last
+// whole word
+bool Autotuner::WriteSample() {
+  if (files_.empty()) {
+    return false;
+  }
+  const long long per_file = max(1LL, sample_bytes_ / (long long) files_.size());
+  vector<char> buf(per_file);
+  for (size_t i = 0; i < files_.size(); ++i) {
+    unique_ptr<InputStream> in(InputStream::Open(
+        files_[i], 0, -1, DetectCompression(files_[i])));
+    if (in == nullptr) {
+      LOG(ERROR) << "fail to open " << files_[i] << endl;
+      return false;
+    }
+    long long size = 0;
+    while (size < per_file) {
+      int64 n = in->Read(&buf[size], per_file - size);
+      if (n <= 0) {
+        break;
+      }
+      size += n;
+    }
+    if (size == per_file) {
+      while (size > 0 && !IsSpace(buf[size - 1])) {
+        --size;
+      }
+    }
+    if (size == 0) {
+      continue;
+    }
+    const string sample = work_dir_ + "/wordvec_autotune_" + to_string(i);
+    FILE* fo = fopen(sample.c_str(), "wb");
+    if (fo == nullptr) {
+      LOG(ERROR) << "fail to open " << sample << endl;
+      return false;
+    }
+    FileCloser fcloser(fo);
+    sample_files_.push_back(sample);
+    if (fwrite(&buf[0], 1, size, fo) != size) {
+      LOG(ERROR) << "fail to write " << sample << endl;
+      return false;
+    }
+  }
+  return !sample_files_.empty();
+}
+
+double Autotuner::Measure(const Options &options) {
+  omp_set_num_threads(options.thread_num);
+  WordVec wordvec(options);
+  if (!wordvec.Train(sample_files_)) {
+    return 0;
+  }
+  const double speed = wordvec.GetTrainWordCount() / wordvec.GetTrainTime();
+  LOG(INFO) << "threads = " << options.thread_num << " sentence_size = "
+            << options.max_sentence_size << " specialized_kernel = "
+            << options.use_specialized_kernel << " reorder_block = "
+            << options.reorder_block_words << " shard_size = "
+            << options.shard_size << ": " << speed << " words/sec"
+            << endl;
+  return speed;
+}
+
+bool Autotuner::Run(Options &best) {
+  if (!WriteSample()) {
+    LOG(ERROR) << "fail to sample the training files" << endl;
+    return false;
+  }
+  const int processor_num = omp_get_num_procs();
+  vector<int> thread_nums;
+  for (int threads = 1; threads < processor_num; threads *= 2) {
+    thread_nums.push_back(threads);
+  }
+  thread_nums.push_back(processor_num);
+
+  Options options = options_;
+  options.shard_size = max(kMinSampleShard, sample_bytes_ / (4 * processor_num));
+  // count the vocabulary of the sample once, every burst reuses it
+  vocab_file_ = work_dir_ + "/wordvec_autotune.vocab";
+  options.save_vocab_file = vocab_file_;
+  options.thread_num = processor_num;
+  omp_set_num_threads(processor_num);
+  {
+    WordVec wordvec(options);
+    if (!wordvec.Train(sample_files_)) {
+      LOG(ERROR) << "fail to train on the sample" << endl;
+      return false;
+    }
+  }
+  options.save_vocab_file.clear();
+  options.read_vocab_file = vocab_file_;
+
+  // threads first, the other choices are measured with the best of them
+  double best_speed = 0;
+  Options current = options;
+  for (const int threads : thread_nums) {
+    current.thread_num = threads;
+    const double speed = Measure(current);
+    if (speed > best_speed) {
+      best_speed = speed;
+      options.thread_num = threads;
+    }
+  }
+
+  current = options;
+  for (const int sentence_size : kSentenceSizes) {
+    current.max_sentence_size = sentence_size;
+    const double speed = Measure(current);
+    if (speed > best_speed) {
+      best_speed = speed;
+      options.max_sentence_size = sentence_size;
+    }
+  }
+
+  current = options;
+  for (const bool specialized : {true, false}) {
+    for (const int block : {0, kReorderBlockWords}) {
+      // the reordered kernels do not slide the context sum
+      if (block > 0 && options.incremental_context > 0) {
+        continue;
+      }
+      current.use_specialized_kernel = specialized;
+      current.reorder_block_words = block;
+      const double speed = Measure(current);
+      if (speed > best_speed) {
+        best_speed = speed;
+        options.use_specialized_kernel = specialized;
+        options.reorder_block_words = block;
+      }
+    }
+  }
+
+  // the shard sizes are measured last, with the thread number they split for
+  int shards_per_thread = 0;
+  current = options;
+  for (const int shards : kShardsPerThread) {
+    current.shard_size = max(kMinSampleShard,
+        sample_bytes_ / ((long long) shards * options.thread_num));
+    const double speed = Measure(current);
+    if (speed > best_speed) {
+      best_speed = speed;
+      shards_per_thread = shards;
+    }
+  }
+
+  best = options_;
+  if (shards_per_thread > 0) {
+    long long corpus_bytes = 0;
+    for (const auto &file : files_) {
+      struct stat st;
+      if (stat(file.c_str(), &st) == 0) {
+        corpus_bytes += st.st_size;
+      }
+    }
+    // -shard_size_mb is in megabytes, round up to at least one
+    const long long shard_bytes =
+        corpus_bytes / ((long long) shards_per_thread * options.thread_num);
+    best.shard_size = max(1LL, (shard_bytes + (1LL << 20) - 1) >> 20) << 20;
+  }
+  best.thread_num = options.thread_num;
+  best.max_sentence_size = options.max_sentence_size;
+  best.use_specialized_kernel = options.use_specialized_kernel;
+  best.reorder_block_words = options.reorder_block_words;
+  best_speed_ = best_speed;
+  omp_set_num_threads(best.thread_num);
+  return true;
+}
+
+bool Autotuner::SaveProfile(const string &file, const Options &options) const {
+  FILE* fo = fopen(file.c_str(), "w");
+  if (fo == nullptr) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return false;
+  }
+  FileCloser fcloser(fo);
+  fprintf(fo, "# wordvec autotune profile, %d processors, %.0f words/sec\n",
+          omp_get_num_procs(), best_speed_);
+  fprintf(fo, "threads=%d\n", options.thread_num);
+  fprintf(fo, "sentence_size=%d\n", options.max_sentence_size);
+  fprintf(fo, "specialized_kernel=%s\n",
+          options.use_specialized_kernel ? "true" : "false");
+  fprintf(fo, "reorder_block=%d\n", options.reorder_block_words);
+  fprintf(fo, "shard_size_mb=%lld\n", options.shard_size >> 20);
+  if (fflush(fo) != 0 || ferror(fo)) {
+    LOG(ERROR) << "fail to write " << file << endl;
+    return false;
+  }
+  return true;
+}
+
+bool Autotuner::ReadProfile(const string &file, map<string, string> &flags) {
+  FILE* fi = fopen(file.c_str(), "r");
+  if (fi == nullptr) {
+    return false;
+  }
+  FileCloser fcloser(fi);
+  char line[1024];
+  while (fgets(line, sizeof(line), fi) != nullptr) {
+    string str(line);
+    while (!str.empty() && IsSpace(str.back())) {
+      str.pop_back();
+    }
+    if (str.empty() || str[0] == '#') {
+      continue;
+    }
+    const size_t eq = str.find('=');
+    if (eq == string::npos || eq == 0) {
+      LOG(ERROR) << "invalid line in profile " << file << ": " << str << endl;
+      return false;
+    }
+    flags[str.substr(0, eq)] = str.substr(eq + 1);
+  }
+  return true;
+}
+
+bool Autotuner::LoadProfile(const string &file) {
+  map<string, string> flags;
+  if (!ReadProfile(file, flags)) {
+    LOG(ERROR) << "fail to load profile " << file << endl;
+    return false;
+  }
+  for (const auto &flag : flags) {
+    ::gflags::CommandLineFlagInfo info;
+    if (!::gflags::GetCommandLineFlagInfo(flag.first.c_str(), &info)) {
+      LOG(WARNING) << "unknown flag " << flag.first << " in profile "
+                   << file << endl;
+      continue;
+    }
+    // the command line wins over the profile
+    if (!info.is_default) {
+      continue;
+    }
+    if (::gflags::SetCommandLineOptionWithMode(flag.first.c_str(),
+            flag.second.c_str(), ::gflags::SET_FLAG_IF_DEFAULT).empty()) {
+      LOG(WARNING) << "invalid value of " << flag.first << " in profile "
+                   << file << ": " << flag.second << endl;
+      continue;
+    }
+    LOG(INFO) << "profile " << file << " sets -" << flag.first << "="
+              << flag.second << endl;
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+/*
+ * autotune.h
+ *
+ * Calibration of the training configuration for the host
+ */
+
+#ifndef AUTOTUNE_H_
+#define AUTOTUNE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "options.h"
+
+// Runs short training bursts on a sample from the head of the training
+// files and searches the thread number, the sentence batch size, the
+// kernel variant and the shard size with the highest throughput, one after
+// another.
+class Autotuner {
+ public:
+  // sample_bytes of text are taken evenly from the files into work_dir
+  Autotuner(const std::vector<std::string> &files, const Options &options,
+            long long sample_bytes, const std::string &work_dir);
+
+  virtual ~Autotuner();
+
+  // Search the configuration, best keeps the other fields of options.
+  // Return false if no sample could be read or trained.
+  bool Run(Options &best);
+
+  // words per second of the best configuration found by Run
+  double GetBestSpeed() const {
+    return best_speed_;
+  }
+
+  // Save the tuned fields of options as flag=value lines of wordvec
+  bool SaveProfile(const std::string &file, const Options &options) const;
+
+  // Read the flag=value lines of a profile, return false if it cannot be
+  // read or has a line that is neither a comment nor flag=value
+  static bool ReadProfile(const std::string &file,
+                          std::map<std::string, std::string> &flags);
+
+  // Set the flags of the profile that were not given on the command line,
+  // logging every flag it changes. Return false and change nothing if the
+  // profile cannot be read, flags unknown to the program are skipped.
+  static bool LoadProfile(const std::string &file);
+
+ private:
+  Autotuner(const Autotuner&);  // no copying!
+
+  void operator=(const Autotuner&);  // no copying!
+
+  bool WriteSample();
+
+  // training throughput of options on the sample, in words per second
+  double Measure(const Options &options);
+
+  std::vector<std::string> files_;
+
+  std::vector<std::string> sample_files_;
+
+  std::string vocab_file_;
+
+  Options options_;
+
+  long long sample_bytes_;
+
+  std::string work_dir_;
+
+  double best_speed_;
+};
+
+#endif // autotune.h
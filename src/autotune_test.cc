@@ -0,0 +1,84 @@
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "autotune.h"
+#include "gflags/gflags.h"
+#include "options.h"
+#include "utils.h"
+
+using namespace std;
+
+// the flags of wordvec a profile sets
+DEFINE_int32(threads, 4, "");
+DEFINE_int32(sentence_size, 1000, "");
+DEFINE_bool(specialized_kernel, true, "");
+DEFINE_int32(reorder_block, 0, "");
+DEFINE_int32(shard_size_mb, 64, "");
+
+namespace {
+const char kProfileFile[] = "autotune_test.profile";
+} // namespace
+
+TEST(TestAutotune, TestProfileRoundTrip) {
+  Options best;
+  best.thread_num = 6;
+  best.max_sentence_size = 5000;
+  best.use_specialized_kernel = false;
+  best.reorder_block_words = 10000;
+  best.shard_size = 8LL << 20;
+  Autotuner tuner(vector<string>(), best, 0, ".");
+  ASSERT_TRUE(tuner.SaveProfile(kProfileFile, best));
+
+  map<string, string> flags;
+  ASSERT_TRUE(Autotuner::ReadProfile(kProfileFile, flags));
+  ASSERT_EQ(5, flags.size());
+  ASSERT_EQ("6", flags["threads"]);
+  ASSERT_EQ("5000", flags["sentence_size"]);
+  ASSERT_EQ("false", flags["specialized_kernel"]);
+  ASSERT_EQ("10000", flags["reorder_block"]);
+  ASSERT_EQ("8", flags["shard_size_mb"]);
+
+  // threads is given on the command line, the profile sets the others
+  ::gflags::SetCommandLineOptionWithMode("threads", "2",
+                                         ::gflags::SET_FLAGS_VALUE);
+  ASSERT_TRUE(Autotuner::LoadProfile(kProfileFile));
+  remove(kProfileFile);
+  ASSERT_EQ(2, FLAGS_threads);
+  ASSERT_EQ(5000, FLAGS_sentence_size);
+  ASSERT_FALSE(FLAGS_specialized_kernel);
+  ASSERT_EQ(10000, FLAGS_reorder_block);
+  ASSERT_EQ(8, FLAGS_shard_size_mb);
+}
+
+TEST(TestAutotune, TestMalformedProfile) {
+  FLAGS_reorder_block = 500;
+  map<string, string> flags;
+  ASSERT_FALSE(Autotuner::ReadProfile("autotune_test.missing", flags));
+  ASSERT_FALSE(Autotuner::LoadProfile("autotune_test.missing"));
+
+  {
+    FILE* fo = fopen(kProfileFile, "w");
+    FileCloser fcloser(fo);
+    fprintf(fo, "# comment\nreorder_block=1\nthreads 8\n");
+  }
+  // nothing is applied from a malformed profile
+  ASSERT_FALSE(Autotuner::LoadProfile(kProfileFile));
+  ASSERT_EQ(500, FLAGS_reorder_block);
+
+  {
+    FILE* fo = fopen(kProfileFile, "w");
+    FileCloser fcloser(fo);
+    fprintf(fo, "no_such_flag=1\n\n");
+  }
+  // unknown flags are skipped
+  ASSERT_TRUE(Autotuner::LoadProfile(kProfileFile));
+  remove(kProfileFile);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,235 @@
+/*
+ * corpus_reader.cc
+ */
+
+#include "corpus_reader.h"
+
+#include <cstdlib>
+#include <omp.h>
+
+using namespace std;
+
+namespace {
+const size_t kPageSize = 4096;
+} // namespace
+
+CorpusReader::CorpusReader(const Vocabulary &vocab, int max_sentence_size,
+                           size_t chunk_size, int hash_buckets)
+    : vocab_(vocab),
+      max_sentence_size_(max_sentence_size),
+      chunk_size_((chunk_size + kPageSize - 1) / kPageSize * kPageSize),
+      hash_buckets_(hash_buckets),
+      offset_(0),
+      end_(-1),
+      buffer_(nullptr),
+      at_word_start_(true),
+      skip_partial_(false),
+      finished_(false),
+      failed_(false),
+      consume_slot_(0),
+      consumed_last_(false),
+      stop_(false),
+      read_time_(0),
+      wait_time_(0) {
+  void* buf = nullptr;
+  if (posix_memalign(&buf, kPageSize, chunk_size_) == 0) {
+    buffer_ = static_cast<char*>(buf);
+  }
+}
+
+CorpusReader::~CorpusReader() {
+  Close();
+  free(buffer_);
+}
+
+void CorpusReader::Close() {
+  if (reader_.joinable()) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    reader_.join();
+  }
+  stream_.reset();
+}
+
+bool CorpusReader::Open(const WorkItem &item) {
+  Close();
+  if (buffer_ == nullptr) {
+    LOG(ERROR) << "fail to allocate read buffer" << endl;
+    return false;
+  }
+  if (item.compression != kNoCompression) {
+    // compressed shards are whole frames, read all of their content
+    stream_.reset(InputStream::Open(item.file, item.begin, item.end,
+                                    item.compression));
+    offset_ = 0;
+    end_ = -1;
+    at_word_start_ = true;
+    skip_partial_ = false;
+  } else {
+    // a word belongs to the shard where it starts, so start from the byte
+    // before begin to find out whether begin is in the middle of a word.
+    // The last word may run past end, so read until end of file.
+    offset_ = item.begin > 0 ? item.begin - 1 : 0;
+    end_ = item.end;
+    at_word_start_ = item.begin == 0;
+    skip_partial_ = item.begin > 0;
+    stream_.reset(InputStream::Open(item.file, offset_, -1, item.compression));
+  }
+  if (stream_ == nullptr) {
+    return false;
+  }
+  word_.clear();
+  sentence_.clear();
+  finished_ = false;
+  failed_ = false;
+  ready_[0] = ready_[1] = false;
+  consume_slot_ = 0;
+  consumed_last_ = false;
+  stop_ = false;
+  reader_ = thread(&CorpusReader::ReadLoop, this);
+
+  return true;
+}
+
+void CorpusReader::ReadLoop() {
+  int slot = 0;
+  bool more = true;
+  while (more) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      cond_.wait(lock, [this, slot]() { return stop_ || !ready_[slot]; });
+      if (stop_) {
+        return;
+      }
+    }
+    double start = omp_get_wtime();
+    SentenceBatch &batch = batches_[slot];
+    more = FillBatch(batch);
+    batch.last = !more;
+    read_time_ += omp_get_wtime() - start;
+    {
+      lock_guard<mutex> lock(mutex_);
+      ready_[slot] = true;
+    }
+    cond_.notify_all();
+    slot ^= 1;
+  }
+}
+
+bool CorpusReader::Next(const SentenceBatch* &batch) {
+  if (consumed_last_ || stream_ == nullptr) {
+    return false;
+  }
+  double start = omp_get_wtime();
+  {
+    unique_lock<mutex> lock(mutex_);
+    // hand the batch returned last time back to the reader thread
+    if (batch == &batches_[consume_slot_ ^ 1]) {
+      ready_[consume_slot_ ^ 1] = false;
+      cond_.notify_all();
+    }
+    cond_.wait(lock, [this]() { return ready_[consume_slot_]; });
+  }
+  wait_time_ += omp_get_wtime() - start;
+
+  batch = &batches_[consume_slot_];
+  consumed_last_ = batch->last;
+  consume_slot_ ^= 1;
+
+  return true;
+}
+
+void CorpusReader::EndSentence(SentenceBatch &batch) {
+  if (sentence_.empty()) {
+    return;
+  }
+  if (batch.sentence_num == batch.sentences.size()) {
+    batch.sentences.emplace_back();
+  }
+  batch.sentences[batch.sentence_num++].assign(sentence_.begin(),
+                                               sentence_.end());
+  batch.word_count += sentence_.size();
+  sentence_.clear();
+}
+
+int CorpusReader::WordId() const {
+  const int word_idx = vocab_.GetWordIndex(word_);
+  if (word_idx != -1 || hash_buckets_ <= 0) {
+    return word_idx;
+  }
+  return vocab_.Size() + HashWord(word_) % hash_buckets_;
+}
+
+// Tokenize the same way as ReadWord: ' ' and '\n' separate words, '\n' also
+// ends a sentence, '\r' and '\t' are dropped
+bool CorpusReader::FillBatch(SentenceBatch &batch) {
+  batch.sentence_num = 0;
+  batch.word_count = 0;
+  if (finished_) {
+    return false;
+  }
+
+  const int64 n = stream_->Read(buffer_, chunk_size_);
+  if (n < 0) {
+    LOG(ERROR) << "fail to read training file" << endl;
+    failed_ = true;
+  }
+
+  for (int64 i = 0; i < n; ++i) {
+    const char ch = buffer_[i];
+    if (ch == ' ' || ch == '\n') {
+      if (!word_.empty()) {
+        int word_idx = WordId();
+        if (word_idx != -1) {
+          sentence_.push_back(word_idx);
+          if (sentence_.size() >= max_sentence_size_) {
+            EndSentence(batch);
+          }
+        }
+        word_.clear();
+      }
+      if (ch == '\n') {
+        EndSentence(batch);
+      }
+      skip_partial_ = false;
+      at_word_start_ = true;
+      continue;
+    }
+    if (skip_partial_) {
+      continue;
+    }
+    if (at_word_start_) {
+      // the words starting from end_ belong to the next shard
+      if (end_ >= 0 && offset_ + i >= end_) {
+        finished_ = true;
+        break;
+      }
+      at_word_start_ = false;
+    }
+    if (ch == '\r' || ch == '\t') {
+      continue;
+    }
+    word_.push_back(ch);
+  }
+  offset_ += n;
+
+  if (n <= 0) {
+    finished_ = true;
+  }
+  if (finished_) {
+    // the last word of file has no separator after it
+    if (!word_.empty()) {
+      int word_idx = WordId();
+      if (word_idx != -1) {
+        sentence_.push_back(word_idx);
+      }
+      word_.clear();
+    }
+    EndSentence(batch);
+  }
+
+  return !finished_;
+}
@@ -0,0 +1,141 @@
+/*
+ * corpus_reader.h
+ *
+ * Read-ahead of training text: a background thread reads large chunks of the
+ * file and turns them into sentences of word ids while the training thread
+ * works on the previous chunk.
+ */
+
+#ifndef CORPUS_READER_H_
+#define CORPUS_READER_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "input_stream.h"
+#include "scheduler.h"
+#include "utils.h"
+#include "vocabulary.h"
+
+// Sentences of word ids produced from one chunk of text
+struct SentenceBatch {
+  // only the first sentence_num sentences are valid, the others are kept to
+  // reuse their memory
+  std::vector<std::vector<int> > sentences;
+  int sentence_num;
+  int word_count;
+  bool last;  // no batch follows this one
+
+  SentenceBatch() : sentence_num(0), word_count(0), last(false) {
+  }
+};
+
+// Double-buffered reader over the words of a shard from FileScheduler,
+// compressed shards are decompressed by the reader thread as well. The reader thread fills
+// one batch while the caller consumes the other.
+class CorpusReader {
+ public:
+  // With hash_buckets > 0 the words out of vocab get the ids
+  // [vocab.Size(), vocab.Size() + hash_buckets) by their hash instead of
+  // being dropped
+  CorpusReader(const Vocabulary &vocab, int max_sentence_size,
+               size_t chunk_size, int hash_buckets = 0);
+
+  virtual ~CorpusReader();
+
+  // Open the shard and start reading ahead
+  bool Open(const WorkItem &item);
+
+  // Block until the next batch is ready, return false when there is no
+  // more. The batch stays valid until the next call.
+  bool Next(const SentenceBatch* &batch);
+
+  // the shard could not be read to its end, valid once Next returned false
+  bool Failed() const {
+    return failed_;
+  }
+
+  // seconds the reader thread spent reading and tokenizing
+  double GetReadTime() const {
+    return read_time_;
+  }
+
+  // seconds the caller spent blocked in Next waiting for data
+  double GetWaitTime() const {
+    return wait_time_;
+  }
+
+ private:
+  void ReadLoop();
+
+  // Read and tokenize one chunk into batch, return false at end of range
+  bool FillBatch(SentenceBatch &batch);
+
+  void EndSentence(SentenceBatch &batch);
+
+  // id of word_, -1 if it is dropped
+  int WordId() const;
+
+  void Close();
+
+  CorpusReader(const CorpusReader&);  // no copying!
+
+  void operator=(const CorpusReader&);  // no copying!
+
+  const Vocabulary &vocab_;
+
+  const int max_sentence_size_;
+
+  const size_t chunk_size_;
+
+  const int hash_buckets_;
+
+  std::unique_ptr<InputStream> stream_;
+
+  int64 offset_;  // file offset of the next byte to read
+
+  int64 end_;
+
+  char* buffer_;  // page aligned read buffer
+
+  // tokenizer state carried across chunks
+  std::string word_;
+
+  std::vector<int> sentence_;
+
+  bool at_word_start_;
+
+  // skipping the partial word at the beginning of a shard
+  bool skip_partial_;
+
+  bool finished_;
+
+  bool failed_;  // a read or decompression error ended the shard
+
+  // double buffering between the reader thread and the caller
+  SentenceBatch batches_[2];
+
+  bool ready_[2];
+
+  int consume_slot_;
+
+  bool consumed_last_;
+
+  bool stop_;
+
+  std::mutex mutex_;
+
+  std::condition_variable cond_;
+
+  std::thread reader_;
+
+  double read_time_;
+
+  double wait_time_;
+};
+
+#endif // corpus_reader.h
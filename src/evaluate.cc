@@ -0,0 +1,250 @@
+/*
+ * evaluate.cc
+ *
+ * Evaluate word vectors with analogy questions (questions-words.txt format)
+ * and word similarity pairs (wordsim353 like "word1 word2 score" lines).
+ * Results are printed as tab separated lines:
+ *   analogy     <section> <correct> <answered> <total> <accuracy>
+ *   similarity  <file>    <pairs>   <total>    <spearman>
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <omp.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "utils.h"
+#include "wordvec_model.h"
+
+using namespace std;
+
+DEFINE_string(model, "word_vector.bin", "word vector model to evaluate");
+DEFINE_bool(binary, true, "the model is in binary format");
+DEFINE_string(analogy, "", "analogy question file");
+DEFINE_string(similarity, "", "comma separated word similarity files");
+DEFINE_bool(lowercase, true, "lowercase the words in evaluation files");
+DEFINE_int32(threads, 4, "multi-thread number");
+DEFINE_bool(buckets, false, "score similarity pairs with words out of the model by the "
+            "vectors of their hash buckets, if the model has them");
+
+namespace {
+struct Section {
+  string name;
+  int correct;
+  int answered;
+  int total;
+
+  explicit Section(const string &name) :
+      name(name), correct(0), answered(0), total(0) {
+  }
+};
+
+string Normalize(string word) {
+  if (FLAGS_lowercase) {
+    transform(word.begin(), word.end(), word.begin(), ::tolower);
+  }
+  return word;
+}
+
+vector<string> Split(const string &line, const string &delims) {
+  vector<string> tokens;
+  size_t pos = 0;
+  while (pos < line.size()) {
+    size_t next = line.find_first_of(delims, pos);
+    if (next == string::npos) {
+      next = line.size();
+    }
+    if (next > pos) {
+      tokens.push_back(line.substr(pos, next - pos));
+    }
+    pos = next + 1;
+  }
+  return tokens;
+}
+
+void PrintAnalogy(const Section &s) {
+  printf("analogy\t%s\t%d\t%d\t%d\t%.4f\n", s.name.c_str(), s.correct,
+         s.answered, s.total, s.answered > 0 ? s.correct * 1.0 / s.answered : 0);
+}
+
+// Question "a b c d" asks for d = b - a + c, all the questions are answered
+// together with one batched scan over the model
+bool EvaluateAnalogy(const WordVecModel &model, const string &file) {
+  ifstream fin(file.c_str());
+  if (!fin) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return false;
+  }
+
+  vector<Section> sections;
+  vector<int> question_section;
+  vector<int> answers;
+  vector<real> queries;
+  vector<vector<int> > excludes;
+  string line;
+  while (getline(fin, line)) {
+    vector<string> tokens = Split(line, " \t\r");
+    if (tokens.empty()) {
+      continue;
+    }
+    if (tokens[0] == ":") {
+      sections.emplace_back(tokens.size() > 1 ? tokens[1] : "");
+      continue;
+    }
+    if (tokens.size() != 4) {
+      continue;
+    }
+    if (sections.empty()) {
+      sections.emplace_back("default");
+    }
+    ++sections.back().total;
+    vector<real> query;
+    vector<int> exclude;
+    const int answer = model.GetWordIndex(Normalize(tokens[3]));
+    if (answer < 0 || !model.AnalogyQuery(Normalize(tokens[1]),
+        Normalize(tokens[0]), Normalize(tokens[2]), query, exclude)) {
+      continue;
+    }
+    ++sections.back().answered;
+    question_section.push_back(sections.size() - 1);
+    answers.push_back(answer);
+    queries.insert(queries.end(), query.begin(), query.end());
+    excludes.push_back(exclude);
+  }
+
+  vector<vector<Neighbor> > results;
+  model.NearestBatch(queries, 1, excludes, results);
+  for (int i = 0; i < results.size(); ++i) {
+    if (!results[i].empty() && results[i][0].index == answers[i]) {
+      ++sections[question_section[i]].correct;
+    }
+  }
+
+  Section total("TOTAL");
+  for (const auto &s : sections) {
+    PrintAnalogy(s);
+    total.correct += s.correct;
+    total.answered += s.answered;
+    total.total += s.total;
+  }
+  PrintAnalogy(total);
+
+  return true;
+}
+
+// Ranks of values, ties get the average rank
+vector<double> Rank(const vector<double> &values) {
+  vector<int> order(values.size());
+  for (int i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(), [&values](int a, int b) {
+    return values[a] < values[b];
+  });
+  vector<double> ranks(values.size());
+  for (int i = 0; i < order.size();) {
+    int j = i;
+    while (j + 1 < order.size() && values[order[j + 1]] == values[order[i]]) {
+      ++j;
+    }
+    for (int k = i; k <= j; ++k) {
+      ranks[order[k]] = (i + j) / 2.0;
+    }
+    i = j + 1;
+  }
+  return ranks;
+}
+
+double Pearson(const vector<double> &x, const vector<double> &y) {
+  const int n = x.size();
+  double mx = 0, my = 0;
+  for (int i = 0; i < n; ++i) {
+    mx += x[i];
+    my += y[i];
+  }
+  mx /= n;
+  my /= n;
+  double sxy = 0, sxx = 0, syy = 0;
+  for (int i = 0; i < n; ++i) {
+    sxy += (x[i] - mx) * (y[i] - my);
+    sxx += (x[i] - mx) * (x[i] - mx);
+    syy += (y[i] - my) * (y[i] - my);
+  }
+  return sxx > 0 && syy > 0 ? sxy / sqrt(sxx * syy) : 0;
+}
+
+// Spearman correlation between human scores and cosine similarities
+bool EvaluateSimilarity(const WordVecModel &model, const string &file) {
+  ifstream fin(file.c_str());
+  if (!fin) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return false;
+  }
+
+  vector<double> human, predicted;
+  int total = 0;
+  string line;
+  while (getline(fin, line)) {
+    vector<string> tokens = Split(line, " \t\r,");
+    if (tokens.size() < 3 || tokens[0][0] == '#') {
+      continue;
+    }
+    char* end = nullptr;
+    const double score = strtod(tokens[2].c_str(), &end);
+    if (end == tokens[2].c_str()) {
+      continue;  // header line
+    }
+    ++total;
+    const string a = Normalize(tokens[0]);
+    const string b = Normalize(tokens[1]);
+    if (!FLAGS_buckets && (model.GetWordIndex(a) < 0
+                           || model.GetWordIndex(b) < 0)) {
+      continue;
+    }
+    real sim = 0;
+    if (model.Similarity(a, b, sim)) {
+      human.push_back(score);
+      predicted.push_back(sim);
+    }
+  }
+
+  const double spearman = human.empty() ? 0 : Pearson(Rank(human),
+                                                      Rank(predicted));
+  printf("similarity\t%s\t%lu\t%d\t%.4f\n", file.c_str(), human.size(), total,
+         spearman);
+
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  ::gflags::ParseCommandLineFlags(&argc, &argv, true);
+  omp_set_num_threads(FLAGS_threads);
+
+  double start = omp_get_wtime();
+  unique_ptr<WordVecModel> model(WordVecModel::Load(FLAGS_model, FLAGS_binary));
+  if (model == nullptr) {
+    return 1;
+  }
+  LOG(INFO) << "Loaded " << model->Size() << " words in "
+            << omp_get_wtime() - start << " sec" << endl;
+
+  bool succeed = true;
+  if (!FLAGS_analogy.empty()) {
+    start = omp_get_wtime();
+    succeed = EvaluateAnalogy(*model, FLAGS_analogy) && succeed;
+    LOG(INFO) << "Analogy cost " << omp_get_wtime() - start << " sec" << endl;
+  }
+  for (const auto &file : Split(FLAGS_similarity, ",")) {
+    succeed = EvaluateSimilarity(*model, file) && succeed;
+  }
+
+  return succeed ? 0 : 1;
+}
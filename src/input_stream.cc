@@ -0,0 +1,230 @@
+/*
+ * input_stream.cc
+ */
+
+#include "input_stream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef WORDVEC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+namespace {
+const unsigned char kGzipMagic[] = {0x1f, 0x8b};
+const unsigned char kZstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+// compressed bytes read at a time
+const size_t kCompressedChunk = 1 << 20;
+
+// pread over a byte range of a plain file
+class PlainInputStream : public InputStream {
+ public:
+  PlainInputStream(int fd, int64 begin, int64 end)
+      : fd_(fd), offset_(begin), end_(end) {
+    posix_fadvise(fd_, begin, end < 0 ? 0 : end - begin, POSIX_FADV_SEQUENTIAL);
+  }
+
+  virtual ~PlainInputStream() {
+    close(fd_);
+  }
+
+  virtual int64 Read(char* buf, size_t size) {
+    if (end_ >= 0) {
+      size = min<int64>(size, end_ - offset_);
+    }
+    if (size == 0) {
+      return 0;
+    }
+    ssize_t n = 0;
+    do {
+      n = pread(fd_, buf, size, offset_);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+      offset_ += n;
+    }
+    return n;
+  }
+
+ private:
+  int fd_;
+  int64 offset_;
+  int64 end_;
+};
+
+// zlib handles concatenated gzip members as well
+class GzipInputStream : public InputStream {
+ public:
+  explicit GzipInputStream(gzFile gz) : gz_(gz) {
+    gzbuffer(gz_, kCompressedChunk);
+  }
+
+  virtual ~GzipInputStream() {
+    gzclose(gz_);
+  }
+
+  virtual int64 Read(char* buf, size_t size) {
+    int n = gzread(gz_, buf, size);
+    // a truncated stream ends like a complete one, only gzerror tells
+    int err = Z_OK;
+    const char* msg = gzerror(gz_, &err);
+    if (n < 0 || (n == 0 && err != Z_OK)) {
+      LOG(ERROR) << "gzip error: " << msg << endl;
+      return -1;
+    }
+    return n;
+  }
+
+ private:
+  gzFile gz_;
+};
+
+#ifdef WORDVEC_HAVE_ZSTD
+// Streaming decompression of the zstd frames in a byte range
+class ZstdInputStream : public InputStream {
+ public:
+  ZstdInputStream(int fd, int64 begin, int64 end)
+      : fd_(fd), offset_(begin), end_(end), dctx_(ZSTD_createDCtx()),
+        in_buf_(kCompressedChunk) {
+    in_.src = &in_buf_[0];
+    in_.size = in_.pos = 0;
+  }
+
+  virtual ~ZstdInputStream() {
+    ZSTD_freeDCtx(dctx_);
+    close(fd_);
+  }
+
+  virtual int64 Read(char* buf, size_t size) {
+    ZSTD_outBuffer out = {buf, size, 0};
+    while (out.pos == 0) {
+      if (in_.pos == in_.size) {
+        size_t want = in_buf_.size();
+        if (end_ >= 0) {
+          want = min<int64>(want, end_ - offset_);
+        }
+        ssize_t n = want > 0 ? pread(fd_, &in_buf_[0], want, offset_) : 0;
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          return n;
+        }
+        offset_ += n;
+        in_.size = n;
+        in_.pos = 0;
+      }
+      size_t ret = ZSTD_decompressStream(dctx_, &out, &in_);
+      if (ZSTD_isError(ret)) {
+        LOG(ERROR) << "zstd error: " << ZSTD_getErrorName(ret) << endl;
+        return -1;
+      }
+    }
+    return out.pos;
+  }
+
+ private:
+  int fd_;
+  int64 offset_;
+  int64 end_;
+  ZSTD_DCtx* dctx_;
+  vector<char> in_buf_;
+  ZSTD_inBuffer in_;
+};
+#endif
+
+} // namespace
+
+Compression DetectCompression(const string &file) {
+  unsigned char magic[4] = {0};
+  FILE* fin = fopen(file.c_str(), "rb");
+  if (fin == nullptr) {
+    return kNoCompression;
+  }
+  FileCloser fcloser(fin);
+  size_t n = fread(magic, 1, sizeof(magic), fin);
+  if (n >= sizeof(kGzipMagic) && memcmp(magic, kGzipMagic, sizeof(kGzipMagic)) == 0) {
+    return kGzip;
+  }
+  if (n >= sizeof(kZstdMagic) && memcmp(magic, kZstdMagic, sizeof(kZstdMagic)) == 0) {
+    return kZstd;
+  }
+  return kNoCompression;
+}
+
+bool GetZstdFrames(const string &file, vector<pair<int64, int64> > &frames) {
+  frames.clear();
+#ifdef WORDVEC_HAVE_ZSTD
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  // only the frame and block headers are touched, not the whole file
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  const char* p = static_cast<const char*>(data);
+  int64 offset = 0;
+  bool succeed = true;
+  while (offset < st.st_size) {
+    size_t frame_size = ZSTD_findFrameCompressedSize(p + offset,
+                                                     st.st_size - offset);
+    if (ZSTD_isError(frame_size)) {
+      succeed = false;
+      break;
+    }
+    frames.emplace_back(offset, offset + frame_size);
+    offset += frame_size;
+  }
+  munmap(data, st.st_size);
+  return succeed;
+#else
+  return false;
+#endif
+}
+
+InputStream* InputStream::Open(const string &file, int64 begin, int64 end,
+                               Compression compression) {
+  if (compression == kGzip) {
+    if (begin != 0) {
+      LOG(ERROR) << "gzip file can only be read from the beginning" << endl;
+      return nullptr;
+    }
+    gzFile gz = gzopen(file.c_str(), "rb");
+    if (gz == nullptr) {
+      LOG(ERROR) << "fail to open " << file << endl;
+      return nullptr;
+    }
+    return new GzipInputStream(gz);
+  }
+
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return nullptr;
+  }
+  if (compression == kZstd) {
+#ifdef WORDVEC_HAVE_ZSTD
+    return new ZstdInputStream(fd, begin, end);
+#else
+    LOG(ERROR) << "zstd support is not compiled in, cannot read " << file << endl;
+    close(fd);
+    return nullptr;
+#endif
+  }
+  return new PlainInputStream(fd, begin, end);
+}
@@ -0,0 +1,49 @@
+/*
+ * input_stream.h
+ *
+ * Sequential reading of training files, decompressing gzip and zstd input
+ * on the fly. The format is detected by the magic bytes of the file.
+ */
+
+#ifndef INPUT_STREAM_H_
+#define INPUT_STREAM_H_
+
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+enum Compression {
+  kNoCompression = 0,
+  kGzip,
+  kZstd
+};
+
+// Detect compression by magic bytes, plain text if unknown or unreadable
+Compression DetectCompression(const std::string &file);
+
+// Byte ranges of the independent frames of a zstd file, in order. Every
+// frame can be decompressed on its own, so the ranges can go to different
+// threads. Return false if the file cannot be parsed or zstd support is not
+// compiled in.
+bool GetZstdFrames(const std::string &file,
+                   std::vector<std::pair<int64, int64> > &frames);
+
+class InputStream {
+ public:
+  virtual ~InputStream() {
+  }
+
+  // Read up to size bytes, return the number of bytes read, 0 at the end of
+  // stream and -1 on error
+  virtual int64 Read(char* buf, size_t size) = 0;
+
+  // Open the bytes [begin, end) of file, end == -1 means until the end of
+  // file. For plain text the range is exact. For compressed files it is
+  // in compressed bytes and must start at a frame (gzip: the whole file),
+  // the stream returns the decompressed content. Return nullptr on failure.
+  static InputStream* Open(const std::string &file, int64 begin, int64 end,
+                           Compression compression);
+};
+
+#endif // input_stream.h
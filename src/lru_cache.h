@@ -0,0 +1,85 @@
+/*
+ * lru_cache.h
+ *
+ * Thread-safe LRU cache split into independently locked shards
+ */
+
+#ifndef LRU_CACHE_H_
+#define LRU_CACHE_H_
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Keys are spread over shards by hash, every shard is a plain LRU list
+// guarded by its own mutex, so concurrent lookups of different keys rarely
+// wait for each other.
+template <typename K, typename V>
+class ShardedLruCache {
+ public:
+  ShardedLruCache(size_t capacity, int shard_num)
+      : shards_(shard_num > 0 ? shard_num : 1) {
+    for (auto &shard : shards_) {
+      shard.capacity = capacity / shards_.size();
+    }
+  }
+
+  // Copy the cached value into value, return false on miss
+  bool Get(const K &key, V &value) {
+    Shard &shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.index.find(key);
+    if (iter == shard.index.end()) {
+      return false;
+    }
+    // move to the front as most recently used
+    shard.items.splice(shard.items.begin(), shard.items, iter->second);
+    value = iter->second->second;
+    return true;
+  }
+
+  void Put(const K &key, const V &value) {
+    Shard &shard = GetShard(key);
+    if (shard.capacity == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.index.find(key);
+    if (iter != shard.index.end()) {
+      iter->second->second = value;
+      shard.items.splice(shard.items.begin(), shard.items, iter->second);
+      return;
+    }
+    shard.items.emplace_front(key, value);
+    shard.index[key] = shard.items.begin();
+    if (shard.items.size() > shard.capacity) {
+      shard.index.erase(shard.items.back().first);
+      shard.items.pop_back();
+    }
+  }
+
+ private:
+  typedef std::list<std::pair<K, V> > ItemList;
+
+  struct Shard {
+    std::mutex mutex;
+    ItemList items;
+    std::unordered_map<K, typename ItemList::iterator> index;
+    size_t capacity;
+  };
+
+  Shard& GetShard(const K &key) {
+    return shards_[std::hash<K>()(key) % shards_.size()];
+  }
+
+  ShardedLruCache(const ShardedLruCache&);  // no copying!
+
+  void operator=(const ShardedLruCache&);  // no copying!
+
+  std::vector<Shard> shards_;
+};
+
+#endif // lru_cache.h
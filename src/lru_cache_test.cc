@@ -0,0 +1,58 @@
+#include <string>
+#include <gtest/gtest.h>
+
+#include "lru_cache.h"
+
+using namespace std;
+
+TEST(TestLruCache, TestEvictionOrder) {
+  ShardedLruCache<string, int> cache(2, 1);
+  cache.Put("a", 1);
+  cache.Put("b", 2);
+  int value = 0;
+  // a becomes the most recently used, so b is evicted by c
+  ASSERT_TRUE(cache.Get("a", value));
+  ASSERT_EQ(1, value);
+  cache.Put("c", 3);
+  ASSERT_FALSE(cache.Get("b", value));
+  ASSERT_TRUE(cache.Get("a", value));
+  ASSERT_TRUE(cache.Get("c", value));
+  ASSERT_EQ(3, value);
+
+  // updating a key refreshes it as well
+  cache.Put("a", 10);
+  cache.Put("d", 4);
+  ASSERT_FALSE(cache.Get("c", value));
+  ASSERT_TRUE(cache.Get("a", value));
+  ASSERT_EQ(10, value);
+}
+
+TEST(TestLruCache, TestShardCapacity) {
+  // 4 shards of 2 items, integer keys hash to themselves
+  ShardedLruCache<int, int> cache(8, 4);
+  for (int i = 0; i < 100; ++i) {
+    cache.Put(i, i);
+  }
+  int hits = 0, value = 0;
+  for (int i = 0; i < 100; ++i) {
+    if (cache.Get(i, value)) {
+      ASSERT_EQ(i, value);
+      ++hits;
+    }
+  }
+  ASSERT_EQ(8, hits);
+  // the last two keys of every shard are kept
+  for (int i = 92; i < 100; ++i) {
+    ASSERT_TRUE(cache.Get(i, value));
+  }
+
+  // capacity is split evenly, a cache smaller than its shards keeps nothing
+  ShardedLruCache<int, int> tiny(3, 4);
+  tiny.Put(1, 1);
+  ASSERT_FALSE(tiny.Get(1, value));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
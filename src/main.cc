@@ -5,8 +5,11 @@
  *      Author: Zeyu Chen(zeyuchen@outlook.com)
  */
 
+#include <cstdlib>
+#include <memory>
 #include <omp.h>
 
+#include "autotune.h"
 #include "gflags/gflags.h"
 #include "utils.h"
 #include "vocabulary.h"
@@ -18,12 +21,48 @@ DEFINE_string(train, "", "file path of training data");
 DEFINE_string(prefix, "", "file prefix");
 DEFINE_int32(threads, 4, "multi-thread number");
 DEFINE_string(output, "word_vector.bin", "word vector model output");
+DEFINE_bool(binary, true, "save word vector model in binary format");
 DEFINE_int32(hidden_size, 100, "neural num of hidden layers");
 DEFINE_int32(window, 5, "sliding window size");
+DEFINE_bool(random_window, false, "draw the window of every word from [1, window] like word2vec");
 DEFINE_bool(cbow, true, "use Continuous Bag of Words model for training");
 DEFINE_bool(skipgram, false, "use Skip-Gram model to train");
 DEFINE_int32(sentence_size, 1000, "max sentence length");
 DEFINE_int32(iter, 1, "iteration for training the corpus");
+DEFINE_int32(hot_output_rows, 0, "per-thread replicas of the output rows nearest the Huffman root, 0 disables");
+DEFINE_int32(incremental_context, 0, "CBOW slides a running sum of the context rows, "
+             "recomputed exactly every this many words, 0 disables");
+DEFINE_int32(reorder_block, 0, "train blocks of about this many words grouped by "
+             "row instead of in sentence order for cache locality, 0 disables");
+DEFINE_int32(hash_buckets, 0, "hash the words below -min_word_freq into this many shared "
+             "rows trained as context, saved to <output>.buckets for the vectors of "
+             "unseen words at lookup time, 0 drops those words");
+DEFINE_int32(shard_size_mb, 64, "split training files into shards of this size, 0 means no split");
+DEFINE_string(sweep, "", "train several configurations in one pass, e.g. "
+              "\"model=cbow,hidden_size=100;model=skipgram,window=8,output=sg.bin\". "
+              "Keys: model, hidden_size, window, hot_output_rows, output. Unset keys "
+              "use the flags, default output is <output>.<index>");
+DEFINE_string(read_vocab, "", "read the vocabulary from file instead of counting the corpus");
+DEFINE_string(save_vocab, "", "save the reduced vocabulary to file");
+DEFINE_bool(specialized_kernel, true, "use the training kernels compiled for common hidden sizes");
+DEFINE_bool(autotune, false, "measure training speed on a sample of the corpus for "
+            "thread numbers, sentence sizes and kernels, print the fastest, save it "
+            "to -profile if given and exit");
+DEFINE_int32(autotune_mb, 16, "megabytes of training text sampled by -autotune");
+DEFINE_string(autotune_dir, "/tmp", "folder to write the sample of -autotune");
+DEFINE_string(profile, "", "profile written by -autotune, or loaded for the flags not "
+              "given on the command line. Empty neither writes nor loads one");
+DEFINE_int32(export_words, 0, "save only this many most frequent words, 0 saves all");
+DEFINE_int32(export_dim, 0, "project the saved vectors to this many principal components, "
+             "0 keeps hidden_size");
+DEFINE_bool(export_normalize, false, "save the vectors scaled to unit length");
+DEFINE_string(init_model, "", "start from the vectors of this binary model, e.g. to continue "
+              "training it on new text");
+DEFINE_string(save_delta, "", "with -init_model, also save the rows training changed and the "
+              "new words to this file, apply it to the old model with wordvec_patch");
+DEFINE_bool(mmap_tables, false, "keep the embedding tables in a memory-mapped "
+            "output file instead of RAM, for vocabularies too large for memory. "
+            "The output is written in the mapped model format");
 
 namespace {
 // Check whether a string is start with specific prefix
@@ -62,6 +101,23 @@ void GetAllFiles(const std::string &folder_path, std::vector<std::string> &files
   delete pDir;
 }
 
+// The mapped tables are finished in place as the output model, which has
+// every word at full dimension, check it before training rather than at save
+bool CheckMappedExport(const Options &options) {
+  if (options.mapped_model_file.empty()) {
+    return true;
+  }
+  if (options.export_words > 0 || options.export_normalize
+      || (options.export_dim > 0
+          && options.export_dim < options.hidden_layer_size)) {
+    LOG(ERROR) << "-mmap_tables saves the trained tables as they are, it "
+               << "cannot be combined with -export_words, -export_normalize "
+               << "or an -export_dim below the hidden size" << endl;
+    return false;
+  }
+  return true;
+}
+
 // create options from flags
 bool PopulateOptions(Options &options) {
   options.model_type = ModelType::kCBOW;
@@ -74,28 +130,146 @@ bool PopulateOptions(Options &options) {
   options.max_sentence_size = FLAGS_sentence_size;
   options.thread_num = FLAGS_threads;
   options.windows_size = FLAGS_window;
+  options.random_window = FLAGS_random_window;
+  options.shard_size = static_cast<long long>(FLAGS_shard_size_mb) << 20;
   options.use_hierachical_softmax = true;
   options.use_negative_sampling = false;
+  options.hot_output_rows = FLAGS_hot_output_rows;
+  options.reorder_block_words = FLAGS_reorder_block;
+  options.incremental_context = FLAGS_incremental_context;
+  options.hash_buckets = FLAGS_hash_buckets;
+  options.use_specialized_kernel = FLAGS_specialized_kernel;
+  options.export_words = FLAGS_export_words;
+  options.export_dim = FLAGS_export_dim;
+  options.export_normalize = FLAGS_export_normalize;
+  options.read_vocab_file = FLAGS_read_vocab;
+  options.save_vocab_file = FLAGS_save_vocab;
+  options.init_model_file = FLAGS_init_model;
+  if (FLAGS_mmap_tables) {
+    options.mapped_model_file = FLAGS_output;
+  }
+  if (!CheckMappedExport(options)) {
+    return false;
+  }
+  if (!FLAGS_save_delta.empty() && options.init_model_file.empty()) {
+    LOG(ERROR) << "-save_delta needs -init_model to tell the changed rows"
+               << endl;
+    return false;
+  }
+  if (!FLAGS_save_delta.empty() && !FLAGS_sweep.empty()) {
+    LOG(ERROR) << "-save_delta is not supported with -sweep" << endl;
+    return false;
+  }
+  if (!FLAGS_save_delta.empty() && (options.export_words > 0
+      || options.export_dim > 0 || options.export_normalize)) {
+    LOG(ERROR) << "-save_delta writes full rows, it cannot be combined with "
+               << "-export_words, -export_dim or -export_normalize" << endl;
+    return false;
+  }
+  if (options.incremental_context > 0 && options.reorder_block_words > 0) {
+    LOG(ERROR) << "-incremental_context does not apply to the kernels of "
+               << "-reorder_block, use one of them" << endl;
+    return false;
+  }
 
   LOG(INFO) << "iter = " << options.iter << endl;
   LOG(INFO) << "hidden_layer_size = " << options.hidden_layer_size << endl;
   LOG(INFO) << "max_sentence_size = " << options.max_sentence_size << endl;
   LOG(INFO) << "thread_num = " << options.thread_num << endl;
   LOG(INFO) << "windows_size = " << options.windows_size << endl;
+  LOG(INFO) << "random_window = " << options.random_window << endl;
+  LOG(INFO) << "shard_size = " << options.shard_size << endl;
   LOG(INFO) << "use_hierachical_softmax = " << options.use_hierachical_softmax
      << endl;
   LOG(INFO) << "use_negative_sampling = " << options.use_negative_sampling
      << endl;
+  LOG(INFO) << "hot_output_rows = " << options.hot_output_rows << endl;
+  LOG(INFO) << "reorder_block_words = " << options.reorder_block_words << endl;
+  LOG(INFO) << "incremental_context = " << options.incremental_context << endl;
+  LOG(INFO) << "hash_buckets = " << options.hash_buckets << endl;
+  LOG(INFO) << "use_specialized_kernel = " << options.use_specialized_kernel
+     << endl;
+  LOG(INFO) << "read_vocab_file = " << options.read_vocab_file << endl;
+  LOG(INFO) << "save_vocab_file = " << options.save_vocab_file << endl;
+  LOG(INFO) << "export_words = " << options.export_words << endl;
+  LOG(INFO) << "export_dim = " << options.export_dim << endl;
+  LOG(INFO) << "export_normalize = " << options.export_normalize << endl;
+  LOG(INFO) << "init_model_file = " << options.init_model_file << endl;
+  LOG(INFO) << "mapped_model_file = " << options.mapped_model_file << endl;
 
   return true;
 }
 
+// Split str by any character in delims, dropping empty pieces
+std::vector<std::string> Split(const std::string &str, const std::string &delims) {
+  std::vector<std::string> pieces;
+  size_t pos = 0;
+  while (pos <= str.size()) {
+    size_t next = str.find_first_of(delims, pos);
+    if (next == std::string::npos) {
+      next = str.size();
+    }
+    if (next > pos) {
+      pieces.push_back(str.substr(pos, next - pos));
+    }
+    pos = next + 1;
+  }
+  return pieces;
+}
+
+// Parse -sweep into one options and output path for each configuration,
+// every configuration starts from the options given by flags
+bool ParseSweep(const std::string &sweep, const Options &base,
+                std::vector<Options> &configs, std::vector<std::string> &outputs) {
+  for (const auto &config : Split(sweep, ";")) {
+    Options options = base;
+    std::string output = FLAGS_output + "." + std::to_string(configs.size());
+    for (const auto &kv : Split(config, ",")) {
+      size_t eq = kv.find('=');
+      if (eq == std::string::npos) {
+        LOG(ERROR) << "invalid sweep item " << kv << endl;
+        return false;
+      }
+      const std::string key = kv.substr(0, eq);
+      const std::string value = kv.substr(eq + 1);
+      if (key == "model" && (value == "cbow" || value == "skipgram")) {
+        options.model_type = value == "cbow" ? ModelType::kCBOW : ModelType::kSkipGram;
+      } else if (key == "hidden_size") {
+        options.hidden_layer_size = atoi(value.c_str());
+      } else if (key == "window") {
+        options.windows_size = atoi(value.c_str());
+      } else if (key == "hot_output_rows") {
+        options.hot_output_rows = atoi(value.c_str());
+      } else if (key == "output") {
+        output = value;
+      } else {
+        LOG(ERROR) << "invalid sweep item " << kv << endl;
+        return false;
+      }
+    }
+    if (FLAGS_mmap_tables) {
+      options.mapped_model_file = output;
+    }
+    // a configuration can raise the hidden size above -export_dim
+    if (!CheckMappedExport(options)) {
+      return false;
+    }
+    configs.push_back(options);
+    outputs.push_back(output);
+  }
+  return !configs.empty();
+}
+
 } // namespace
 
 int main(int argc, char* argv[]) {
 
   // use google-flags to parse command line
   ::gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (!FLAGS_autotune && !FLAGS_profile.empty()
+      && !Autotuner::LoadProfile(FLAGS_profile)) {
+    return 1;
+  }
 
   printf("======================================================\n");
   printf("|                      WordVec                       |\n");
@@ -118,14 +292,78 @@ int main(int argc, char* argv[]) {
 
   // Fill in wordvec options
   Options options;
-  PopulateOptions(options);
+  if (!PopulateOptions(options)) {
+    return 1;
+  }
+
+  if (FLAGS_autotune) {
+    Autotuner tuner(files, options,
+                    static_cast<long long>(FLAGS_autotune_mb) << 20,
+                    FLAGS_autotune_dir);
+    Options best;
+    if (!tuner.Run(best)) {
+      return 1;
+    }
+    printf("best: threads = %d sentence_size = %d specialized_kernel = %d "
+           "reorder_block = %d shard_size_mb = %lld, %.0f words/sec\n",
+           best.thread_num, best.max_sentence_size,
+           best.use_specialized_kernel, best.reorder_block_words,
+           best.shard_size >> 20, tuner.GetBestSpeed());
+    if (FLAGS_profile.empty()) {
+      return 0;
+    }
+    if (!tuner.SaveProfile(FLAGS_profile, best)) {
+      return 1;
+    }
+    printf("profile saved to %s\n", FLAGS_profile.c_str());
+    return 0;
+  }
+
+  if (!FLAGS_sweep.empty()) {
+    // several configurations share one pass over the corpus
+    vector<Options> configs;
+    vector<string> outputs;
+    if (!ParseSweep(FLAGS_sweep, options, configs, outputs)) {
+      return 1;
+    }
+    vector<unique_ptr<WordVec> > models;
+    vector<WordVec*> model_ptrs;
+    for (size_t i = 0; i < configs.size(); ++i) {
+      printf("config %lu: %s hidden_size = %d window = %d -> %s\n", i,
+             configs[i].model_type == ModelType::kCBOW ? "cbow" : "skipgram",
+             configs[i].hidden_layer_size, configs[i].windows_size,
+             outputs[i].c_str());
+      models.emplace_back(new WordVec(configs[i]));
+      model_ptrs.push_back(models.back().get());
+    }
+    if (!WordVec::TrainModels(model_ptrs, files)) {
+      return 1;
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < models.size(); ++i) {
+      if (!models[i]->SaveVector(outputs[i], FLAGS_binary)) {
+        ret = 1;
+      }
+    }
+    return ret;
+  }
 
   WordVec wordvec(options);
 
   // Training word vector by loading multiple files
   // NOTE: parallel by files with OpenMP, one thread for one training file
-  wordvec.Train(files);
+  if (!wordvec.Train(files)) {
+    return 1;
+  }
 
   // Save word vector model
-  wordvec.SaveVector(FLAGS_output, true);
+  if (!wordvec.SaveVector(FLAGS_output, FLAGS_binary)) {
+    return 1;
+  }
+  if (!FLAGS_save_delta.empty() && !wordvec.SaveDelta(FLAGS_save_delta)) {
+    return 1;
+  }
+
+  return 0;
 }
@@ -0,0 +1,80 @@
+/*
+ * mapped_table.cc
+ */
+
+#include "mapped_table.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+const char kMappedModelMagic[8] = {'W', 'V', 'M', 'A', 'P', '0', '0', '1'};
+
+MappedTable::MappedTable()
+    : fd_(-1), base_(nullptr), size_(0), offset_(0), dim_(0) {
+}
+
+MappedTable::~MappedTable() {
+  if (base_ != nullptr) {
+    munmap(base_, size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool MappedTable::Create(const string &file, size_t offset, size_t rows,
+                         int dim, bool keep_file) {
+  fd_ = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "fail to create " << file << endl;
+    return false;
+  }
+  if (!keep_file) {
+    unlink(file.c_str());
+  }
+  offset_ = offset;
+  dim_ = dim;
+  size_ = offset + rows * dim * sizeof(real);
+  // the file is sparse, pages are allocated when rows are first written
+  if (ftruncate(fd_, size_) != 0) {
+    LOG(ERROR) << "fail to resize " << file << " to " << size_ << endl;
+    return false;
+  }
+  void* data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "fail to mmap " << file << endl;
+    return false;
+  }
+  base_ = static_cast<char*>(data);
+  // rows are visited in random order during training
+  madvise(base_, size_, MADV_RANDOM);
+
+  return true;
+}
+
+bool MappedTable::Sync() const {
+  return base_ != nullptr && msync(base_, size_, MS_SYNC) == 0;
+}
+
+double MappedTable::Residency(size_t row_begin, size_t row_end) const {
+  const size_t page = sysconf(_SC_PAGESIZE);
+  size_t begin = offset_ + row_begin * dim_ * sizeof(real);
+  size_t end = offset_ + row_end * dim_ * sizeof(real);
+  begin = begin / page * page;
+  if (base_ == nullptr || end <= begin) {
+    return 0;
+  }
+  vector<unsigned char> vec((end - begin + page - 1) / page);
+  if (mincore(base_ + begin, end - begin, &vec[0]) != 0) {
+    return 0;
+  }
+  size_t resident = 0;
+  for (unsigned char v : vec) {
+    resident += v & 1;
+  }
+  return resident * 1.0 / vec.size();
+}
@@ -0,0 +1,78 @@
+/*
+ * mapped_table.h
+ *
+ * Embedding tables backed by memory-mapped files, for vocabularies whose
+ * tables do not fit in RAM
+ */
+
+#ifndef MAPPED_TABLE_H_
+#define MAPPED_TABLE_H_
+
+#include <string>
+
+#include "utils.h"
+
+// Layout of a mapped model file: this header, the rows x dim float matrix
+// starting at matrix_offset (page aligned), then the words separated by '\n'
+// starting at words_offset. Written by WordVec with -mmap_tables, read by
+// WordVecModel::Load.
+struct MappedModelHeader {
+  char magic[8];
+  uint64 rows;
+  uint64 dim;
+  uint64 matrix_offset;
+  uint64 words_offset;
+};
+
+extern const char kMappedModelMagic[8];
+
+// A rows x dim table of reals in a shared file mapping. The kernel pages the
+// rows in and out on demand, so only the frequently used rows stay resident.
+class MappedTable {
+ public:
+  MappedTable();
+
+  virtual ~MappedTable();
+
+  // Create file with room for offset bytes followed by the table and map it.
+  // If keep_file is false the file is unlinked right away and only serves
+  // as swap space for the mapping.
+  bool Create(const std::string &file, size_t offset, size_t rows, int dim,
+              bool keep_file);
+
+  real* Data() const {
+    return reinterpret_cast<real*>(base_ + offset_);
+  }
+
+  // Start of the mapping, where the header lives
+  char* Base() const {
+    return base_;
+  }
+
+  int GetFd() const {
+    return fd_;
+  }
+
+  // Flush dirty pages to the file
+  bool Sync() const;
+
+  // Share of the pages holding rows [row_begin, row_end) that are resident
+  double Residency(size_t row_begin, size_t row_end) const;
+
+ private:
+  MappedTable(const MappedTable&);  // no copying!
+
+  void operator=(const MappedTable&);  // no copying!
+
+  int fd_;
+
+  char* base_;
+
+  size_t size_;  // bytes mapped
+
+  size_t offset_;
+
+  int dim_;
+};
+
+#endif // mapped_table.h
@@ -0,0 +1,254 @@
+/*
+ * model_delta.cc
+ */
+
+#include "model_delta.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+using namespace std;
+
+const char kModelDeltaMagic[] = "wvdelta";
+
+namespace {
+// A read only mapping of a whole file
+class FileMapping {
+ public:
+  FileMapping() : data_(nullptr), size_(0) {
+  }
+
+  ~FileMapping() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+  }
+
+  bool Open(const string &file) {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      LOG(ERROR) << "fail to open " << file << endl;
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      LOG(ERROR) << "fail to stat " << file << endl;
+      close(fd);
+      return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      LOG(ERROR) << "fail to mmap " << file << endl;
+      return false;
+    }
+    data_ = static_cast<char*>(data);
+    size_ = st.st_size;
+    return true;
+  }
+
+  const char* Data() const {
+    return data_;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+ private:
+  FileMapping(const FileMapping&);  // no copying!
+
+  void operator=(const FileMapping&);  // no copying!
+
+  char* data_;
+
+  size_t size_;
+};
+
+// A row of a binary model: the word and the offset of its vector
+struct Row {
+  string word;
+  size_t offset;
+};
+
+// Parse exactly row_num rows of "<word> <dim reals>\n" from p up to end,
+// return false if the data is truncated, has more rows or is not binary,
+// e.g. a text model
+bool ParseRows(const char* p, const char* end, long long row_num, int dim,
+               const char* base, vector<Row> &rows) {
+  const long long row_bytes = dim * sizeof(real);
+  rows.reserve(row_num);
+  for (long long i = 0; i < row_num; ++i) {
+    while (p < end && (*p == ' ' || *p == '\n')) {
+      ++p;
+    }
+    const char* word_begin = p;
+    while (p < end && *p != ' ') {
+      ++p;
+    }
+    // the vector has to be followed by the newline ending the row
+    if (p == word_begin || end - p < 2 + row_bytes
+        || p[1 + row_bytes] != '\n') {
+      return false;
+    }
+    Row row;
+    row.word.assign(word_begin, p - word_begin);
+    row.offset = p + 1 - base;
+    rows.push_back(row);
+    p += 2 + row_bytes;
+  }
+  return p == end;
+}
+
+bool WriteAll(int fd, const char* data, size_t size, off_t offset) {
+  while (size > 0) {
+    ssize_t n = pwrite(fd, data, size, offset);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+}
+
+bool ApplyModelDelta(const string &model_file, const string &delta_file) {
+  FileMapping model, delta;
+  if (!model.Open(model_file) || !delta.Open(delta_file)) {
+    return false;
+  }
+
+  // the delta header: magic, dimension and row number
+  char magic[16] = {0};
+  int delta_dim = 0;
+  long long delta_rows = 0;
+  const char* delta_end = delta.Data() + delta.Size();
+  const char* header_end = static_cast<const char*>(
+      memchr(delta.Data(), '\n', delta.Size()));
+  if (header_end == nullptr
+      || sscanf(string(delta.Data(), header_end).c_str(), "%15s %d %lld",
+                magic, &delta_dim, &delta_rows) != 3
+      || strcmp(magic, kModelDeltaMagic) != 0) {
+    LOG(ERROR) << delta_file << " is not a model delta" << endl;
+    return false;
+  }
+  vector<Row> changes;
+  if (!ParseRows(header_end + 1, delta_end, delta_rows, delta_dim,
+                 delta.Data(), changes)) {
+    LOG(ERROR) << "malformed delta " << delta_file << endl;
+    return false;
+  }
+
+  // the model header: word number and dimension
+  const char* model_end = model.Data() + model.Size();
+  const char* model_header_end = static_cast<const char*>(
+      memchr(model.Data(), '\n', model.Size()));
+  long long word_num = 0;
+  int dim = 0;
+  if (model_header_end == nullptr
+      || sscanf(string(model.Data(), model_header_end).c_str(), "%lld %d",
+                &word_num, &dim) != 2) {
+    LOG(ERROR) << model_file << " is not a binary model" << endl;
+    return false;
+  }
+  if (dim != delta_dim) {
+    LOG(ERROR) << "dimension of delta " << delta_dim << " does not match "
+               << dim << " of " << model_file << endl;
+    return false;
+  }
+  vector<Row> rows;
+  if (!ParseRows(model_header_end + 1, model_end, word_num, dim, model.Data(),
+                 rows)) {
+    LOG(ERROR) << "fail to parse binary model " << model_file << endl;
+    return false;
+  }
+  unordered_map<string, size_t> offsets;
+  offsets.reserve(rows.size());
+  for (const auto &row : rows) {
+    offsets[row.word] = row.offset;
+  }
+
+  // the rows of new words, appended at the end of the model
+  string appended;
+  long long added = 0;
+  vector<pair<size_t, const char*> > updates;
+  const size_t row_bytes = dim * sizeof(real);
+  for (const auto &change : changes) {
+    const char* vec = delta.Data() + change.offset;
+    auto iter = offsets.find(change.word);
+    if (iter != offsets.end()) {
+      updates.emplace_back(iter->second, vec);
+    } else {
+      appended.append(change.word);
+      appended.push_back(' ');
+      appended.append(vec, row_bytes);
+      appended.push_back('\n');
+      ++added;
+    }
+  }
+  const string old_header(model.Data(), model_header_end);
+  string header = to_string(word_num + added) + " " + to_string(dim);
+
+  if (header.size() <= old_header.size()) {
+    // the loaders skip spaces, so the new header is padded to the old width
+    header.resize(old_header.size(), ' ');
+    int fd = open(model_file.c_str(), O_WRONLY);
+    if (fd < 0) {
+      LOG(ERROR) << "fail to open " << model_file << endl;
+      return false;
+    }
+    bool succeed = true;
+    for (const auto &update : updates) {
+      succeed = succeed && WriteAll(fd, update.second, row_bytes, update.first);
+    }
+    // the rows go before the header, a model cut short by a crash still
+    // reads as the old word number
+    succeed = succeed
+        && WriteAll(fd, appended.data(), appended.size(), model.Size())
+        && fsync(fd) == 0
+        && WriteAll(fd, header.data(), header.size(), 0)
+        && fsync(fd) == 0;
+    close(fd);
+    if (!succeed) {
+      LOG(ERROR) << "fail to write " << model_file << endl;
+    }
+    return succeed;
+  }
+
+  // the header grows, rewrite the model with the header shifted
+  const string tmp_file = model_file + ".patch.tmp";
+  FILE* fo = fopen(tmp_file.c_str(), "wb");
+  if (fo == nullptr) {
+    LOG(ERROR) << "fail to open " << tmp_file << endl;
+    return false;
+  }
+  bool succeed;
+  {
+    FileCloser fcloser(fo);
+    vector<char> body(model_header_end, model_end);
+    for (const auto &update : updates) {
+      memcpy(&body[update.first - old_header.size()], update.second, row_bytes);
+    }
+    succeed = fwrite(header.data(), 1, header.size(), fo) == header.size()
+        && fwrite(&body[0], 1, body.size(), fo) == body.size()
+        && fwrite(appended.data(), 1, appended.size(), fo) == appended.size()
+        && fflush(fo) == 0 && fsync(fileno(fo)) == 0;
+  }
+  if (!succeed || rename(tmp_file.c_str(), model_file.c_str()) != 0) {
+    LOG(ERROR) << "fail to write " << tmp_file << endl;
+    remove(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,26 @@
+/*
+ * model_delta.h
+ *
+ * Deltas between binary models, to redeploy a model after a continued
+ * training run without shipping the whole matrix
+ */
+
+#ifndef MODEL_DELTA_H_
+#define MODEL_DELTA_H_
+
+#include <string>
+
+// Header of a delta file, followed by row_num rows in the binary model
+// format of WordVec::SaveVector, "<word> <dim reals>\n". Rows of words in
+// the base model replace their vectors, the others are appended.
+extern const char kModelDeltaMagic[];
+
+// Apply the delta to the binary model file in place: changed rows are
+// overwritten where they are and new words appended. Only when the word
+// number in the header outgrows its digits the model is rewritten through
+// a temporary file. Return false on error, the model is left untouched if
+// it is not a binary model or the delta does not match it.
+bool ApplyModelDelta(const std::string &model_file,
+                     const std::string &delta_file);
+
+#endif // model_delta.h
@@ -11,10 +11,22 @@ Options::Options()
     : hidden_layer_size(100),
       max_sentence_size(1000),
       thread_num(4),
+      windows_size(5),
+      random_window(false),
       iter(1),
+      shard_size(64LL << 20),
+      read_chunk_size(4LL << 20),
       model_type(ModelType::kCBOW),
       use_hierachical_softmax(true),
-      use_negative_sampling(false) {
+      use_negative_sampling(false),
+      use_specialized_kernel(true),
+      hot_output_rows(0),
+      incremental_context(0),
+      reorder_block_words(0),
+      hash_buckets(0),
+      export_words(0),
+      export_dim(0),
+      export_normalize(false) {
 }
 
 
@@ -10,6 +10,8 @@
 #ifndef OPTIONS_H_
 #define OPTIONS_H_
 
+#include <string>
+
 enum ModelType {
   kCBOW = 0x01,
   kSkipGram = 0x02
@@ -22,16 +24,77 @@ struct Options {
 
   int thread_num;
 
+  // context words on each side of the target
   int windows_size;
 
+  // draw the window of every token uniformly from [1, windows_size] like
+  // word2vec, which halves the context work on average and weights the
+  // near words higher
+  bool random_window;
+
   int iter;
 
+  // training files larger than it are split into shards of about this many
+  // bytes for the scheduler, 0 means one shard per file
+  long long shard_size;
+
+  // bytes read and tokenized ahead of training at a time
+  long long read_chunk_size;
+
   ModelType model_type;
 
   bool use_hierachical_softmax;
 
   bool use_negative_sampling;
 
+  // use the training kernels compiled for common hidden layer sizes
+  bool use_specialized_kernel;
+
+  // number of output rows closest to the Huffman root that every thread
+  // trains on its own replica and merges back periodically, 0 disables it
+  int hot_output_rows;
+
+  // CBOW keeps a running sum of the context rows as the window slides and
+  // recomputes it exactly every this many targets, 0 sums the whole context
+  // of every target
+  int incremental_context;
+
+  // about this many words of sentences are turned into training pairs and
+  // trained grouped by row instead of in sentence order, so consecutive
+  // updates hit the same rows in cache. 0 trains in sentence order.
+  int reorder_block_words;
+
+  // words below the frequency cutoff are hashed into this many rows shared
+  // between them, appended to the input layer after the vocabulary. They
+  // only serve as context and are never predicted. 0 skips those words.
+  int hash_buckets;
+
+  // load the vocabulary from this file instead of counting the corpus
+  std::string read_vocab_file;
+
+  // save the reduced vocabulary to this file for later runs
+  std::string save_vocab_file;
+
+  // start the input layer from the vectors of the words in this binary
+  // model, and track the rows training changes for SaveDelta
+  std::string init_model_file;
+
+  // back the input layer by a memory-mapped file of this name instead of
+  // RAM, the file becomes the trained model, see mapped_table.h. The output
+  // layer is mapped to an unlinked scratch file next to it. Empty keeps the
+  // tables in memory.
+  std::string mapped_model_file;
+
+  // SaveVector exports only the this many most frequent words, 0 exports all
+  int export_words;
+
+  // SaveVector projects the vectors to this many principal components,
+  // 0 keeps hidden_layer_size
+  int export_dim;
+
+  // SaveVector scales the exported vectors to unit length
+  bool export_normalize;
+
   Options();
 };
 
@@ -0,0 +1,51 @@
+/*
+ * patch.cc
+ *
+ * Apply a delta saved by wordvec -save_delta to the binary model it was
+ * trained from, in place:
+ *   wordvec_patch -model word_vector.bin -delta word_vector.delta
+ * The delta of the hash buckets, saved next to the delta with -hash_buckets,
+ * is applied to the buckets next to the model.
+ */
+
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+#include "gflags/gflags.h"
+#include "model_delta.h"
+#include "utils.h"
+
+using namespace std;
+
+DEFINE_string(model, "", "binary model to patch in place");
+DEFINE_string(delta, "", "delta saved by wordvec -save_delta");
+
+int main(int argc, char* argv[]) {
+  ::gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_model.empty() || FLAGS_delta.empty()) {
+    fprintf(stderr, "usage: %s -model <model> -delta <delta>\n", argv[0]);
+    return 1;
+  }
+  const string bucket_delta = FLAGS_delta + kBucketFileSuffix;
+  const string buckets = FLAGS_model + kBucketFileSuffix;
+  const bool patch_buckets = access(bucket_delta.c_str(), F_OK) == 0;
+  // check before patching anything, the words and buckets go together
+  if (patch_buckets && access(buckets.c_str(), F_OK) != 0) {
+    fprintf(stderr, "%s has buckets but %s does not exist\n",
+            FLAGS_delta.c_str(), buckets.c_str());
+    return 1;
+  }
+  if (!ApplyModelDelta(FLAGS_model, FLAGS_delta)) {
+    return 1;
+  }
+  printf("patched %s with %s\n", FLAGS_model.c_str(), FLAGS_delta.c_str());
+  if (patch_buckets) {
+    if (!ApplyModelDelta(buckets, bucket_delta)) {
+      return 1;
+    }
+    printf("patched %s with %s\n", buckets.c_str(), bucket_delta.c_str());
+  }
+
+  return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * projection.cc
+ */
+
+#include "projection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <omp.h>
+
+using namespace std;
+
+namespace {
+// Jacobi sweeps stop when the off diagonal norm falls below this share of
+// the total norm, or after kMaxSweeps
+const double kJacobiTolerance = 1e-12;
+
+const int kMaxSweeps = 50;
+
+// Diagonalize the n x n symmetric matrix a with cyclic Jacobi rotations.
+// On return the diagonal of a holds the eigenvalues and the columns of v
+// the eigenvectors.
+void JacobiEigen(vector<double> &a, vector<double> &v, int n) {
+  v.assign(static_cast<size_t>(n) * n, 0);
+  double total = 0;
+  for (int i = 0; i < n; ++i) {
+    v[static_cast<size_t>(i) * n + i] = 1;
+    for (int j = 0; j < n; ++j) {
+      total += a[static_cast<size_t>(i) * n + j] * a[static_cast<size_t>(i) * n + j];
+    }
+  }
+  for (int sweep = 0; sweep < kMaxSweeps; ++sweep) {
+    double off = 0;
+    for (int i = 0; i < n; ++i) {
+      for (int j = i + 1; j < n; ++j) {
+        off += a[static_cast<size_t>(i) * n + j] * a[static_cast<size_t>(i) * n + j];
+      }
+    }
+    if (off <= kJacobiTolerance * total) {
+      break;
+    }
+    for (int p = 0; p < n; ++p) {
+      for (int q = p + 1; q < n; ++q) {
+        const double apq = a[static_cast<size_t>(p) * n + q];
+        if (apq == 0) {
+          continue;
+        }
+        const double app = a[static_cast<size_t>(p) * n + p];
+        const double aqq = a[static_cast<size_t>(q) * n + q];
+        // the rotation zeroing a[p][q]
+        const double theta = (aqq - app) / (2 * apq);
+        const double t = (theta >= 0 ? 1 : -1)
+            / (fabs(theta) + sqrt(theta * theta + 1));
+        const double c = 1 / sqrt(t * t + 1);
+        const double s = t * c;
+        for (int k = 0; k < n; ++k) {
+          double* akp = &a[static_cast<size_t>(k) * n + p];
+          double* akq = &a[static_cast<size_t>(k) * n + q];
+          const double x = *akp, y = *akq;
+          *akp = c * x - s * y;
+          *akq = s * x + c * y;
+        }
+        for (int k = 0; k < n; ++k) {
+          double* apk = &a[static_cast<size_t>(p) * n + k];
+          double* aqk = &a[static_cast<size_t>(q) * n + k];
+          const double x = *apk, y = *aqk;
+          *apk = c * x - s * y;
+          *aqk = s * x + c * y;
+        }
+        for (int k = 0; k < n; ++k) {
+          double* vkp = &v[static_cast<size_t>(k) * n + p];
+          double* vkq = &v[static_cast<size_t>(k) * n + q];
+          const double x = *vkp, y = *vkq;
+          *vkp = c * x - s * y;
+          *vkq = s * x + c * y;
+        }
+      }
+    }
+  }
+}
+}
+
+PcaProjection::PcaProjection(int dim, int target_dim)
+    : dim_(dim), target_dim_(target_dim), explained_variance_(0) {
+}
+
+PcaProjection::~PcaProjection() = default;
+
+PcaProjection* PcaProjection::Fit(const real* matrix, size_t rows, int dim,
+                                  int target_dim) {
+  if (rows == 0 || dim <= 0 || target_dim < 1 || target_dim > dim) {
+    return nullptr;
+  }
+  unique_ptr<PcaProjection> pca(new PcaProjection(dim, target_dim));
+  const long long row_num = rows;
+
+  // mean, then the upper triangle of the covariance, every thread sums its
+  // own rows
+  vector<double> mean(dim, 0);
+#pragma omp parallel
+  {
+    vector<double> local(dim, 0);
+#pragma omp for schedule(static)
+    for (long long i = 0; i < row_num; ++i) {
+      const real* row = matrix + static_cast<size_t>(i) * dim;
+      for (int j = 0; j < dim; ++j) {
+        local[j] += row[j];
+      }
+    }
+#pragma omp critical (pca_mean)
+    for (int j = 0; j < dim; ++j) {
+      mean[j] += local[j];
+    }
+  }
+  for (int j = 0; j < dim; ++j) {
+    mean[j] /= rows;
+  }
+
+  const size_t dim2 = static_cast<size_t>(dim) * dim;
+  vector<double> cov(dim2, 0);
+#pragma omp parallel
+  {
+    vector<double> local(dim2, 0);
+    vector<double> centered(dim);
+#pragma omp for schedule(static)
+    for (long long i = 0; i < row_num; ++i) {
+      const real* row = matrix + static_cast<size_t>(i) * dim;
+      for (int j = 0; j < dim; ++j) {
+        centered[j] = row[j] - mean[j];
+      }
+      for (int j = 0; j < dim; ++j) {
+        double* acc = &local[static_cast<size_t>(j) * dim];
+        const double x = centered[j];
+        for (int k = j; k < dim; ++k) {
+          acc[k] += x * centered[k];
+        }
+      }
+    }
+#pragma omp critical (pca_cov)
+    for (size_t j = 0; j < dim2; ++j) {
+      cov[j] += local[j];
+    }
+  }
+  for (int j = 0; j < dim; ++j) {
+    for (int k = j; k < dim; ++k) {
+      cov[static_cast<size_t>(j) * dim + k] /= rows;
+      cov[static_cast<size_t>(k) * dim + j] = cov[static_cast<size_t>(j) * dim + k];
+    }
+  }
+
+  vector<double> vectors;
+  JacobiEigen(cov, vectors, dim);
+
+  // keep the axes of the target_dim largest eigenvalues
+  vector<int> order(dim);
+  double total = 0;
+  for (int j = 0; j < dim; ++j) {
+    order[j] = j;
+    total += cov[static_cast<size_t>(j) * dim + j];
+  }
+  sort(order.begin(), order.end(), [&cov, dim](int a, int b) {
+    return cov[static_cast<size_t>(a) * dim + a]
+        > cov[static_cast<size_t>(b) * dim + b];
+  });
+  pca->mean_.assign(mean.begin(), mean.end());
+  pca->axes_.resize(static_cast<size_t>(target_dim) * dim);
+  double kept = 0;
+  for (int a = 0; a < target_dim; ++a) {
+    const int col = order[a];
+    kept += cov[static_cast<size_t>(col) * dim + col];
+    for (int j = 0; j < dim; ++j) {
+      pca->axes_[static_cast<size_t>(a) * dim + j] =
+          vectors[static_cast<size_t>(j) * dim + col];
+    }
+  }
+  pca->explained_variance_ = total > 0 ? kept / total : 1;
+
+  return pca.release();
+}
+
+void PcaProjection::Project(const real* matrix, size_t rows, real* out) const {
+  const long long row_num = rows;
+#pragma omp parallel
+  {
+    vector<real> centered(dim_);
+#pragma omp for schedule(static)
+    for (long long i = 0; i < row_num; ++i) {
+      const real* row = matrix + static_cast<size_t>(i) * dim_;
+      for (int j = 0; j < dim_; ++j) {
+        centered[j] = row[j] - mean_[j];
+      }
+      real* projected = out + static_cast<size_t>(i) * target_dim_;
+      for (int a = 0; a < target_dim_; ++a) {
+        const real* axis = &axes_[static_cast<size_t>(a) * dim_];
+        real sum = 0;
+        for (int j = 0; j < dim_; ++j) {
+          sum += centered[j] * axis[j];
+        }
+        projected[a] = sum;
+      }
+    }
+  }
+}
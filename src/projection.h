@@ -0,0 +1,63 @@
+/*
+ * projection.h
+ *
+ * Principal component projection of word vectors for smaller exported models
+ */
+
+#ifndef PROJECTION_H_
+#define PROJECTION_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "utils.h"
+
+// Projects vectors onto the principal axes of the rows it was fitted on.
+// The covariance is accumulated by all threads, then diagonalized with
+// cyclic Jacobi rotations, cheap for the few hundred dimensions of a model.
+class PcaProjection {
+ public:
+  virtual ~PcaProjection();
+
+  // Fit the target_dim principal axes of the rows x dim row major matrix,
+  // return nullptr if target_dim is not in [1, dim] or there are no rows
+  static PcaProjection* Fit(const real* matrix, size_t rows, int dim,
+                            int target_dim);
+
+  // Center and project the rows x Dimension() matrix into out, which holds
+  // rows x TargetDimension() reals
+  void Project(const real* matrix, size_t rows, real* out) const;
+
+  int Dimension() const {
+    return dim_;
+  }
+
+  int TargetDimension() const {
+    return target_dim_;
+  }
+
+  // share of the variance kept by the projection
+  double GetExplainedVariance() const {
+    return explained_variance_;
+  }
+
+ private:
+  PcaProjection(int dim, int target_dim);
+
+  PcaProjection(const PcaProjection&);  // no copying!
+
+  void operator=(const PcaProjection&);  // no copying!
+
+  int dim_;
+
+  int target_dim_;
+
+  std::vector<real> mean_;
+
+  // target_dim_ x dim_ principal axes, the one with the largest variance first
+  std::vector<real> axes_;
+
+  double explained_variance_;
+};
+
+#endif // projection.h
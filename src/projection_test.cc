@@ -0,0 +1,45 @@
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "projection.h"
+#include "utils.h"
+
+using namespace std;
+
+TEST(TestProjection, TestPrincipalAxes) {
+  // points spread along (1, 1, 0), a little along (1, -1, 0), none along z
+  vector<real> matrix;
+  for (int i = -50; i <= 50; ++i) {
+    const real a = i * 0.1, b = (i % 3) * 0.01;
+    matrix.insert(matrix.end(), {a + b + 1, a - b + 2, 3});
+  }
+  const size_t rows = matrix.size() / 3;
+  unique_ptr<PcaProjection> pca(PcaProjection::Fit(&matrix[0], rows, 3, 1));
+  ASSERT_TRUE(pca != nullptr);
+  ASSERT_EQ(1, pca->TargetDimension());
+  ASSERT_GT(pca->GetExplainedVariance(), 0.99);
+
+  // the coordinate on the main axis is the distance from the mean along it
+  vector<real> projected(rows);
+  pca->Project(&matrix[0], rows, &projected[0]);
+  const real sign = projected.back() > 0 ? 1 : -1;
+  for (size_t i = 0; i < rows; ++i) {
+    const real a = (static_cast<int>(i) - 50) * 0.1;
+    ASSERT_NEAR(a * sqrt(2.0), sign * projected[i], 0.05);
+  }
+}
+
+TEST(TestProjection, TestInvalidDimension) {
+  vector<real> matrix(6, 1);
+  ASSERT_TRUE(PcaProjection::Fit(&matrix[0], 2, 3, 0) == nullptr);
+  ASSERT_TRUE(PcaProjection::Fit(&matrix[0], 2, 3, 4) == nullptr);
+  unique_ptr<PcaProjection> pca(PcaProjection::Fit(&matrix[0], 2, 3, 3));
+  ASSERT_TRUE(pca != nullptr);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
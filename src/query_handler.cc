@@ -0,0 +1,134 @@
+/*
+ * query_handler.cc
+ */
+
+#include "query_handler.h"
+
+#include <vector>
+
+using namespace std;
+
+namespace {
+const char* kCommandNames[kCommandNum] =
+    {"VEC", "TOPK", "ANALOGY", "STATS", "INVALID"};
+} // namespace
+
+LatencyHistogram::LatencyHistogram() : count_(0), total_us_(0) {
+  for (auto &b : buckets_) {
+    b = 0;
+  }
+}
+
+void LatencyHistogram::Add(int64 us) {
+  int bucket = 0;
+  while (bucket + 1 < kLatencyBuckets && (1LL << bucket) < us) {
+    ++bucket;
+  }
+  ++buckets_[bucket];
+  ++count_;
+  total_us_ += us;
+}
+
+int64 LatencyHistogram::Percentile(double p) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  const uint64 target = count_ * p;
+  uint64 seen = 0;
+  for (int b = 0; b < kLatencyBuckets; ++b) {
+    seen += buckets_[b];
+    if (seen > target) {
+      return 1LL << b;
+    }
+  }
+  return 1LL << (kLatencyBuckets - 1);
+}
+
+void LatencyHistogram::Print(const string &name, ostringstream &out) const {
+  const uint64 count = count_;
+  out << name << " count=" << count
+      << " avg_us=" << (count > 0 ? total_us_ / count : 0)
+      << " p50_us<=" << Percentile(0.5)
+      << " p99_us<=" << Percentile(0.99)
+      << " p999_us<=" << Percentile(0.999) << "\n";
+}
+
+QueryHandler::QueryHandler(const WordVecModel &model, size_t cache_size,
+                           int cache_shards, int max_k)
+    : model_(model), max_k_(max_k), cache_(cache_size, cache_shards),
+      cache_hits_(0) {
+}
+
+Command QueryHandler::Handle(const string &request, string &response) {
+  istringstream in(request);
+  string name;
+  in >> name;
+  if (name == "STATS") {
+    response = Stats();
+    return kStats;
+  }
+  if (name == "VEC") {
+    string word;
+    in >> word;
+    const real* vec = model_.GetVector(word);
+    if (vec == nullptr) {
+      response = "ERR unknown word " + word;
+      return kVec;
+    }
+    ostringstream out;
+    out << "OK";
+    for (int i = 0; i < model_.Dimension(); ++i) {
+      out << " " << vec[i];
+    }
+    response = out.str();
+    return kVec;
+  }
+
+  if (name != "TOPK" && name != "ANALOGY") {
+    response = "ERR unknown command " + name;
+    return kInvalid;
+  }
+  const Command cmd = name == "ANALOGY" ? kAnalogy : kTopK;
+  if (cache_.Get(request, response)) {
+    ++cache_hits_;
+    return cmd;
+  }
+  int k = 0;
+  in >> k;
+  if (k <= 0 || k > max_k_) {
+    response = "ERR invalid k";
+    return cmd;
+  }
+  vector<Neighbor> result;
+  bool found = false;
+  if (cmd == kTopK) {
+    string word;
+    in >> word;
+    found = model_.MostSimilar(word, k, result);
+  } else {
+    string a, b, c;
+    in >> a >> b >> c;
+    found = model_.Analogy(a, b, c, k, result);
+  }
+  if (!found) {
+    response = "ERR unknown word";
+    return cmd;
+  }
+  ostringstream out;
+  out << "OK";
+  for (const auto &n : result) {
+    out << "\n" << model_.GetWord(n.index) << " " << n.score;
+  }
+  response = out.str();
+  cache_.Put(request, response);
+  return cmd;
+}
+
+string QueryHandler::Stats() const {
+  ostringstream out;
+  out << "OK\ncache_hits=" << cache_hits_ << "\n";
+  for (int i = 0; i < kCommandNum; ++i) {
+    latency_[i].Print(kCommandNames[i], out);
+  }
+  return out.str();
+}
@@ -0,0 +1,85 @@
+/*
+ * query_handler.h
+ *
+ * Requests of the wordvec_serve protocol answered against a loaded model,
+ * independent of the socket handling in serve.cc
+ */
+
+#ifndef QUERY_HANDLER_H_
+#define QUERY_HANDLER_H_
+
+#include <atomic>
+#include <sstream>
+#include <string>
+
+#include "lru_cache.h"
+#include "utils.h"
+#include "wordvec_model.h"
+
+// kInvalid accounts the requests of unknown commands
+enum Command { kVec = 0, kTopK, kAnalogy, kStats, kInvalid, kCommandNum };
+
+// latency buckets are powers of two in microseconds, up to ~2 seconds
+const int kLatencyBuckets = 22;
+
+// Lock-free latency histogram, one per command
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void Add(int64 us);
+
+  // Upper bound in microseconds of the bucket holding the p-th quantile
+  int64 Percentile(double p) const;
+
+  void Print(const std::string &name, std::ostringstream &out) const;
+
+ private:
+  std::atomic<uint64> buckets_[kLatencyBuckets];
+  std::atomic<uint64> count_;
+  std::atomic<uint64> total_us_;
+};
+
+// Answers the requests
+//   VEC <word>
+//   TOPK <k> <word>
+//   ANALOGY <k> <a> <b> <c>      (words closest to a - b + c)
+//   STATS
+// with responses starting with "OK" or "ERR". TOPK and ANALOGY results are
+// cached. Handle can be called from any number of threads concurrently.
+class QueryHandler {
+ public:
+  QueryHandler(const WordVecModel &model, size_t cache_size, int cache_shards,
+               int max_k);
+
+  // Answer request into response, return the command it was
+  Command Handle(const std::string &request, std::string &response);
+
+  // account the time a request of cmd took for STATS
+  void AddLatency(Command cmd, int64 us) {
+    latency_[cmd].Add(us);
+  }
+
+  uint64 GetCacheHits() const {
+    return cache_hits_;
+  }
+
+ private:
+  std::string Stats() const;
+
+  QueryHandler(const QueryHandler&);  // no copying!
+
+  void operator=(const QueryHandler&);  // no copying!
+
+  const WordVecModel &model_;
+
+  const int max_k_;
+
+  ShardedLruCache<std::string, std::string> cache_;
+
+  std::atomic<uint64> cache_hits_;
+
+  LatencyHistogram latency_[kCommandNum];
+};
+
+#endif // query_handler.h
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "query_handler.h"
+#include "test_util.h"
+#include "utils.h"
+#include "wordvec_model.h"
+
+using namespace std;
+
+namespace {
+const char kModelFile[] = "query_handler_test.bin";
+} // namespace
+
+TEST(TestQueryHandler, TestVec) {
+  unique_ptr<WordVecModel> model = LoadTestModel(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+  QueryHandler handler(*model, 100, 4, 10);
+  string response;
+  ASSERT_EQ(kVec, handler.Handle("VEC man", response));
+  ASSERT_EQ("OK 0 1 0", response);
+  ASSERT_EQ(kVec, handler.Handle("VEC pear", response));
+  ASSERT_EQ("ERR unknown word pear", response);
+}
+
+TEST(TestQueryHandler, TestTopK) {
+  unique_ptr<WordVecModel> model = LoadTestModel(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+  QueryHandler handler(*model, 100, 4, 10);
+  string response;
+  ASSERT_EQ(kTopK, handler.Handle("TOPK 2 man", response));
+  // king is the only word sharing a dimension with man
+  ASSERT_EQ(0, response.compare(0, 8, "OK\nking "));
+  ASSERT_EQ(2, count(response.begin(), response.end(), '\n'));
+
+  // the same request is answered from the cache
+  string cached;
+  ASSERT_EQ(0, handler.GetCacheHits());
+  ASSERT_EQ(kTopK, handler.Handle("TOPK 2 man", cached));
+  ASSERT_EQ(response, cached);
+  ASSERT_EQ(1, handler.GetCacheHits());
+
+  ASSERT_EQ(kTopK, handler.Handle("TOPK 0 man", response));
+  ASSERT_EQ("ERR invalid k", response);
+  ASSERT_EQ(kTopK, handler.Handle("TOPK 11 man", response));
+  ASSERT_EQ("ERR invalid k", response);
+  ASSERT_EQ(kTopK, handler.Handle("TOPK 2 pear", response));
+  ASSERT_EQ("ERR unknown word", response);
+}
+
+TEST(TestQueryHandler, TestAnalogy) {
+  unique_ptr<WordVecModel> model = LoadTestModel(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+  QueryHandler handler(*model, 100, 4, 10);
+  string response;
+  ASSERT_EQ(kAnalogy, handler.Handle("ANALOGY 1 king man woman", response));
+  ASSERT_EQ(0, response.compare(0, 9, "OK\nqueen "));
+  ASSERT_EQ(1, count(response.begin(), response.end(), '\n'));
+  ASSERT_EQ(kAnalogy, handler.Handle("ANALOGY 1 king man pear", response));
+  ASSERT_EQ("ERR unknown word", response);
+}
+
+TEST(TestQueryHandler, TestErrorsAndStats) {
+  unique_ptr<WordVecModel> model = LoadTestModel(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+  QueryHandler handler(*model, 100, 4, 10);
+  string response;
+  ASSERT_EQ(kInvalid, handler.Handle("FOO 1 king", response));
+  ASSERT_EQ("ERR unknown command FOO", response);
+
+  handler.AddLatency(kVec, 3);
+  ASSERT_EQ(kStats, handler.Handle("STATS", response));
+  ASSERT_EQ(0, response.compare(0, 15, "OK\ncache_hits=0"));
+  ASSERT_NE(string::npos, response.find("VEC count=1 avg_us=3 p50_us<=4"));
+  ASSERT_NE(string::npos, response.find("ANALOGY count=0"));
+  ASSERT_NE(string::npos, response.find("TOPK count=0"));
+  ASSERT_NE(string::npos, response.find("INVALID count=0"));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,79 @@
+/*
+ * scheduler.cc
+ */
+
+#include "scheduler.h"
+
+#include <algorithm>
+
+using namespace std;
+
+FileScheduler::FileScheduler(const vector<string> &files, int64 shard_size)
+    : next_(0), total_bytes_(0) {
+  for (const auto &f : files) {
+    struct stat st;
+    if (stat(f.c_str(), &st) != 0) {
+      LOG(ERROR) << "fail to stat " << f << endl;
+      // keep it, opening the file later reports the error
+      items_.emplace_back(f, 0, -1);
+      continue;
+    }
+    const int64 file_size = st.st_size;
+    total_bytes_ += file_size;
+    const Compression compression = DetectCompression(f);
+    if (compression == kGzip) {
+      // a gzip stream can only be decompressed from the beginning
+      items_.emplace_back(f, 0, file_size, compression);
+      continue;
+    }
+    if (compression == kZstd) {
+      AddZstdFile(f, file_size, shard_size);
+      continue;
+    }
+    if (shard_size <= 0 || file_size <= shard_size) {
+      items_.emplace_back(f, 0, file_size);
+      continue;
+    }
+    // split into equal shards no larger than shard_size
+    const int64 shard_num = (file_size + shard_size - 1) / shard_size;
+    for (int64 i = 0; i < shard_num; ++i) {
+      items_.emplace_back(f, file_size * i / shard_num,
+                          file_size * (i + 1) / shard_num);
+    }
+  }
+
+  // largest first, so the small ones fill the gaps at the end
+  stable_sort(items_.begin(), items_.end(),
+              [](const WorkItem &a, const WorkItem &b) {
+    return a.Size() > b.Size();
+  });
+}
+
+// Group consecutive zstd frames into shards of about shard_size compressed
+// bytes, so that multi-frame files are decompressed by several threads
+void FileScheduler::AddZstdFile(const string &file, int64 file_size,
+                                int64 shard_size) {
+  vector<pair<int64, int64> > frames;
+  if (shard_size <= 0 || !GetZstdFrames(file, frames) || frames.empty()) {
+    items_.emplace_back(file, 0, file_size, kZstd);
+    return;
+  }
+  int64 shard_begin = frames[0].first;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    const int64 frame_end = frames[i].second;
+    if (i + 1 == frames.size() || frame_end - shard_begin >= shard_size) {
+      items_.emplace_back(file, shard_begin, frame_end, kZstd);
+      shard_begin = frame_end;
+    }
+  }
+}
+
+bool FileScheduler::Next(WorkItem &item) {
+  const size_t idx = next_.fetch_add(1);
+  if (idx >= items_.size()) {
+    return false;
+  }
+  item = items_[idx];
+
+  return true;
+}
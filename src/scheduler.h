@@ -0,0 +1,77 @@
+/*
+ * scheduler.h
+ *
+ * Size-aware scheduling of training files for the worker threads
+ */
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "input_stream.h"
+#include "utils.h"
+
+// A byte range [begin, end) of a training file, end == -1 means until EOF.
+// A word belongs to the range where it starts. Ranges of compressed files
+// cover whole frames and are measured in compressed bytes.
+struct WorkItem {
+  std::string file;
+  int64 begin;
+  int64 end;
+  Compression compression;
+
+  WorkItem() : begin(0), end(-1), compression(kNoCompression) {
+  }
+
+  WorkItem(const std::string &file, int64 begin, int64 end,
+           Compression compression = kNoCompression) :
+      file(file), begin(begin), end(end), compression(compression) {
+  }
+
+  int64 Size() const {
+    return end - begin;
+  }
+};
+
+// Splits the training files into shards of roughly shard_size bytes and
+// hands them out largest first. Threads take the next shard as soon as they
+// are idle, so big files no longer pin the whole run on one thread.
+class FileScheduler {
+ public:
+  // shard_size <= 0 keeps every file as a single work item
+  FileScheduler(const std::vector<std::string> &files, int64 shard_size);
+
+  // Thread-safe, return false when all the work has been taken
+  bool Next(WorkItem &item);
+
+  // Make all the work available again, e.g. for the next epoch
+  void Reset() {
+    next_ = 0;
+  }
+
+  size_t Size() const {
+    return items_.size();
+  }
+
+  int64 TotalBytes() const {
+    return total_bytes_;
+  }
+
+ private:
+  void AddZstdFile(const std::string &file, int64 file_size, int64 shard_size);
+
+  FileScheduler(const FileScheduler&);  // no copying!
+
+  void operator=(const FileScheduler&);  // no copying!
+
+  std::vector<WorkItem> items_;
+
+  std::atomic<size_t> next_;
+
+  int64 total_bytes_;
+};
+
+#endif // scheduler.h
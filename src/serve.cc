@@ -0,0 +1,360 @@
+/*
+ * serve.cc
+ *
+ * Long-running similarity server over a Unix domain socket. The model is
+ * loaded once and queries are answered by a pool of worker threads.
+ *
+ * Every request and response is a 4-byte big-endian length followed by
+ * that many bytes of text. Requests:
+ *   VEC <word>
+ *   TOPK <k> <word>
+ *   ANALOGY <k> <a> <b> <c>      (words closest to a - b + c)
+ *   STATS
+ * Responses start with "OK" or "ERR".
+ */
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "query_handler.h"
+#include "utils.h"
+#include "wordvec_model.h"
+
+using namespace std;
+
+DEFINE_string(model, "word_vector.bin", "word vector model to serve");
+DEFINE_bool(binary, true, "the model is in binary format");
+DEFINE_string(socket, "/tmp/wordvec.sock", "unix domain socket path");
+DEFINE_int32(threads, 4, "number of worker threads");
+DEFINE_int32(cache_size, 100000, "number of cached query results, 0 disables cache");
+DEFINE_int32(cache_shards, 16, "number of independently locked cache shards");
+DEFINE_int32(max_k, 1000, "maximum number of neighbours per query");
+DEFINE_int32(timeout_ms, 1000, "drop a connection that takes longer than this to "
+             "send the rest of a request or to take the response, 0 waits forever");
+DEFINE_string(query, "", "client mode: send this request to the server and print the response");
+
+namespace {
+// requests larger than it are rejected
+const uint32 kMaxMessageSize = 1 << 20;
+
+atomic<bool> g_stop(false);
+
+void HandleSignal(int) {
+  g_stop = true;
+}
+
+// Blocking queue of connections with a request pending, shared by the
+// workers
+class ConnectionQueue {
+ public:
+  ConnectionQueue() : closed_(false) {
+  }
+
+  void Push(int fd) {
+    lock_guard<mutex> lock(mutex_);
+    fds_.push(fd);
+    cond_.notify_one();
+  }
+
+  // Return -1 when the queue is closed
+  int Pop() {
+    unique_lock<mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return closed_ || !fds_.empty(); });
+    if (fds_.empty()) {
+      return -1;
+    }
+    int fd = fds_.front();
+    fds_.pop();
+    return fd;
+  }
+
+  void Close() {
+    lock_guard<mutex> lock(mutex_);
+    closed_ = true;
+    cond_.notify_all();
+  }
+
+ private:
+  mutex mutex_;
+  condition_variable cond_;
+  queue<int> fds_;
+  bool closed_;
+};
+
+bool ReadFully(int fd, char* buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = read(fd, buf, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool WriteFully(int fd, const char* buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, buf, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool ReadMessage(int fd, string &message) {
+  uint32 len = 0;
+  if (!ReadFully(fd, reinterpret_cast<char*>(&len), sizeof(len))) {
+    return false;
+  }
+  len = ntohl(len);
+  if (len > kMaxMessageSize) {
+    return false;
+  }
+  message.resize(len);
+  return len == 0 || ReadFully(fd, &message[0], len);
+}
+
+bool WriteMessage(int fd, const string &message) {
+  const uint32 len = htonl(message.size());
+  return WriteFully(fd, reinterpret_cast<const char*>(&len), sizeof(len))
+      && WriteFully(fd, message.data(), message.size());
+}
+
+// The acceptor thread polls the listening socket and every connection
+// waiting for its next request. A readable connection is queued to the
+// workers, which answer one request and hand the connection back, so idle
+// clients never hold a worker.
+class Server {
+ public:
+  Server(const WordVecModel &model)
+      : handler_(model, FLAGS_cache_size, FLAGS_cache_shards, FLAGS_max_k) {
+    wake_[0] = wake_[1] = -1;
+  }
+
+  bool Serve(int listen_fd) {
+    // workers write to the pipe when they hand back a connection, which
+    // wakes the poll up to watch it again
+    if (pipe(wake_) != 0 || fcntl(wake_[1], F_SETFL, O_NONBLOCK) != 0) {
+      LOG(ERROR) << "fail to create pipe" << endl;
+      return false;
+    }
+    vector<thread> workers;
+    for (int i = 0; i < FLAGS_threads; ++i) {
+      workers.emplace_back(&Server::WorkerLoop, this);
+    }
+    vector<int> idle;  // connections waiting for their next request
+    vector<struct pollfd> pfds;
+    // poll with timeout so that a signal can stop the loop
+    while (!g_stop) {
+      pfds.clear();
+      pfds.push_back({listen_fd, POLLIN, 0});
+      pfds.push_back({wake_[0], POLLIN, 0});
+      for (const int fd : idle) {
+        pfds.push_back({fd, POLLIN, 0});
+      }
+      if (poll(&pfds[0], pfds.size(), 200) <= 0) {
+        continue;
+      }
+      if (pfds[1].revents & POLLIN) {
+        char buf[256];
+        ssize_t n = read(wake_[0], buf, sizeof(buf));
+        (void) n;
+      }
+      // a request or a hang-up, the worker finds out which
+      idle.clear();
+      for (size_t i = 2; i < pfds.size(); ++i) {
+        if (pfds[i].revents != 0) {
+          connections_.Push(pfds[i].fd);
+        } else {
+          idle.push_back(pfds[i].fd);
+        }
+      }
+      {
+        lock_guard<mutex> lock(returned_mutex_);
+        idle.insert(idle.end(), returned_.begin(), returned_.end());
+        returned_.clear();
+      }
+      if (pfds[0].revents & POLLIN) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd >= 0) {
+          // a client stalling in the middle of a message must not hold
+          // a worker, the blocked read or write fails after the timeout
+          struct timeval timeout;
+          timeout.tv_sec = FLAGS_timeout_ms / 1000;
+          timeout.tv_usec = FLAGS_timeout_ms % 1000 * 1000;
+          setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+          setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+          idle.push_back(fd);
+        }
+      }
+    }
+    connections_.Close();
+    for (auto &w : workers) {
+      w.join();
+    }
+    for (const int fd : idle) {
+      close(fd);
+    }
+    for (const int fd : returned_) {
+      close(fd);
+    }
+    close(wake_[0]);
+    close(wake_[1]);
+    return true;
+  }
+
+ private:
+  void WorkerLoop() {
+    int fd;
+    string request, response;
+    while ((fd = connections_.Pop()) >= 0) {
+      if (!ReadMessage(fd, request)) {
+        close(fd);
+        continue;
+      }
+      auto start = chrono::steady_clock::now();
+      Command cmd = handler_.Handle(request, response);
+      if (!WriteMessage(fd, response)) {
+        close(fd);
+        continue;
+      }
+      handler_.AddLatency(cmd, chrono::duration_cast<chrono::microseconds>(
+          chrono::steady_clock::now() - start).count());
+      HandBack(fd);
+    }
+  }
+
+  // return a connection to the acceptor to wait for its next request
+  void HandBack(int fd) {
+    {
+      lock_guard<mutex> lock(returned_mutex_);
+      returned_.push_back(fd);
+    }
+    const char wake = 0;
+    ssize_t n = write(wake_[1], &wake, 1);
+    (void) n;  // a full pipe wakes the poll up already
+  }
+
+  QueryHandler handler_;
+
+  ConnectionQueue connections_;
+
+  mutex returned_mutex_;
+
+  vector<int> returned_;
+
+  int wake_[2];
+};
+
+int Connect(const string &path, bool listen_mode) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    LOG(ERROR) << "fail to create socket" << endl;
+    return -1;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LOG(ERROR) << "socket path too long: " << path << endl;
+    close(fd);
+    return -1;
+  }
+  strcpy(addr.sun_path, path.c_str());
+  int ret = 0;
+  if (listen_mode) {
+    unlink(path.c_str());
+    ret = ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    if (ret == 0) {
+      ret = listen(fd, 128);
+    }
+  } else {
+    ret = connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+  }
+  if (ret != 0) {
+    LOG(ERROR) << "fail to " << (listen_mode ? "listen on " : "connect to ")
+               << path << ": " << strerror(errno) << endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Client mode, send one request and print the response
+int RunQuery(const string &request) {
+  int fd = Connect(FLAGS_socket, false);
+  if (fd < 0) {
+    return 1;
+  }
+  string response;
+  bool succeed = WriteMessage(fd, request) && ReadMessage(fd, response);
+  close(fd);
+  if (!succeed) {
+    LOG(ERROR) << "fail to query " << FLAGS_socket << endl;
+    return 1;
+  }
+  printf("%s\n", response.c_str());
+  return response.compare(0, 2, "OK") == 0 ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  ::gflags::ParseCommandLineFlags(&argc, &argv, true);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (!FLAGS_query.empty()) {
+    return RunQuery(FLAGS_query);
+  }
+
+  unique_ptr<WordVecModel> model(WordVecModel::Load(FLAGS_model, FLAGS_binary));
+  if (model == nullptr) {
+    return 1;
+  }
+  LOG(INFO) << "Loaded " << model->Size() << " words" << endl;
+
+  int listen_fd = Connect(FLAGS_socket, true);
+  if (listen_fd < 0) {
+    return 1;
+  }
+  signal(SIGINT, HandleSignal);
+  signal(SIGTERM, HandleSignal);
+  LOG(INFO) << "Serving on " << FLAGS_socket << " with " << FLAGS_threads
+            << " threads" << endl;
+
+  Server server(*model);
+  const bool succeed = server.Serve(listen_fd);
+
+  close(listen_fd);
+  unlink(FLAGS_socket.c_str());
+  return succeed ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+/*
+ * test_util.h
+ *
+ * Model fixtures shared by the tests
+ */
+
+#ifndef TEST_UTIL_H_
+#define TEST_UTIL_H_
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "wordvec_model.h"
+
+// Write a model in the binary format of WordVec::SaveVector
+inline void WriteTestModel(const std::string &file,
+                           const std::vector<std::string> &words,
+                           const std::vector<std::vector<real> > &vecs) {
+  FILE* fo = fopen(file.c_str(), "wb");
+  FileCloser fcloser(fo);
+  fprintf(fo, "%lld %lld\n", (long long) words.size(),
+      (long long) vecs[0].size());
+  for (size_t i = 0; i < words.size(); ++i) {
+    fprintf(fo, "%s ", words[i].c_str());
+    fwrite(&vecs[i][0], sizeof(real), vecs[i].size(), fo);
+    fprintf(fo, "\n");
+  }
+}
+
+// Load a model of five words through file, king and queen share a
+// direction, man and woman are orthogonal and apple opposes king
+inline std::unique_ptr<WordVecModel> LoadTestModel(const std::string &file) {
+  WriteTestModel(file, {"king", "queen", "man", "woman", "apple"},
+                 {{1, 1, 0}, {1, 0, 1}, {0, 1, 0}, {0, 0, 1}, {-1, 0, 0}});
+  std::unique_ptr<WordVecModel> model(WordVecModel::Load(file));
+  remove(file.c_str());
+  return model;
+}
+
+#endif // test_util.h
@@ -1,5 +1,7 @@
 #include "utils.h"
 
+#include <cmath>
+
 using namespace std;
 
 char kSegmentFaultCauser[] = "Used to cause artificial segmentation fault";
@@ -25,3 +27,35 @@ bool ReadWord(string &word, FILE* fin) {
 
   return true;
 }
+
+void AppendReal(string &buf, real value) {
+  const double v = value;
+  if (!(fabs(v) < 1e9)) {  // inf, nan and huge values
+    char tmp[64];
+    int len = snprintf(tmp, sizeof(tmp), "%lf", v);
+    buf.append(tmp, len);
+    return;
+  }
+  if (signbit(v)) {
+    buf.push_back('-');
+  }
+  // A float times 1e6 is exact in a double, so ties are exact too and
+  // llrint rounds them to even like printf, e.g. 0.0078125 to 0.007812
+  const long long scaled = llrint(fabs(v) * 1e6);
+  const long long int_part = scaled / 1000000;
+  long long frac_part = scaled % 1000000;
+
+  char tmp[32];
+  int pos = sizeof(tmp);
+  for (int i = 0; i < 6; ++i) {
+    tmp[--pos] = '0' + frac_part % 10;
+    frac_part /= 10;
+  }
+  tmp[--pos] = '.';
+  long long n = int_part;
+  do {
+    tmp[--pos] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+  buf.append(tmp + pos, sizeof(tmp) - pos);
+}
@@ -114,8 +114,34 @@ inline int RandInt(int bound) {
     return static_cast<int>(RandReal() * bound);
 }
 
+// Advance the linear congruential generator of word2vec and return its new
+// state. Much cheaper than rand() and thread safe with one state per thread,
+// use the high bits, the low ones have short periods.
+inline uint64 NextRandom(uint64 &state) {
+    state = state * 25214903917ULL + 11;
+    return state;
+}
+
+// FNV-1a hash of word, picks the shared bucket row of a word out of the
+// vocabulary with -hash_buckets
+inline uint32 HashWord(const std::string &word) {
+    uint32 hash = 2166136261u;
+    for (const unsigned char ch : word) {
+        hash ^= ch;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// the bucket rows are saved next to the model in a file of this suffix
+const char kBucketFileSuffix[] = ".buckets";
+
 bool ReadWord(std::string &word, FILE* fin);
 
+// Append value in the same format as printf("%lf"), much faster than going
+// through the stdio formatting machinery
+void AppendReal(std::string &buf, real value);
+
 class FileCloser {
  public:
   FileCloser(FILE* f) : f_(f) {
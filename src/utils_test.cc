@@ -0,0 +1,50 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "utils.h"
+
+using namespace std;
+
+namespace {
+string Printf(real value) {
+  char tmp[64];
+  snprintf(tmp, sizeof(tmp), "%lf", static_cast<double>(value));
+  return tmp;
+}
+
+string Append(real value) {
+  string buf;
+  AppendReal(buf, value);
+  return buf;
+}
+} // namespace
+
+TEST(TestUtils, TestAppendRealTies) {
+  // m/128 has 7 binary digits, the 7th decimal is exactly 5 for odd m
+  ASSERT_EQ("0.007812", Append(1 / 128.0f));
+  ASSERT_EQ("-0.007812", Append(-1 / 128.0f));
+  for (int m = -100000; m <= 100000; ++m) {
+    const real value = m / 128.0f;
+    ASSERT_EQ(Printf(value), Append(value)) << m;
+  }
+}
+
+TEST(TestUtils, TestAppendRealRandom) {
+  uint64 state = 1;
+  for (int i = 0; i < 1000000; ++i) {
+    uint32 bits = NextRandom(state) >> 32;
+    real value;
+    memcpy(&value, &bits, sizeof(value));
+    ASSERT_EQ(Printf(value), Append(value)) << bits;
+  }
+  ASSERT_EQ(Printf(-0.0f), Append(-0.0f));
+  ASSERT_EQ(Printf(1e10f), Append(1e10f));
+  ASSERT_EQ(Printf(999999999.0f), Append(999999999.0f));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -7,21 +7,56 @@
 
 #include "vocabulary.h"
 
-#include <queue>
+#include <cstring>
+#include <memory>
 
 #include "gflags/gflags.h"
+#include "input_stream.h"
 #include "utils.h"
 
 using namespace std;
 
 DEFINE_int32(min_word_freq, 5, "the minimum word frequecy in vocabulary");
+DEFINE_int32(vocab_memory_mb, 0,
+             "memory limit in MB when counting vocabulary, 0 means no limit");
 
 namespace {
 const int kNoParent = -1;
 
+// bytes read from training file at a time when counting words
+const size_t kReadBufferSize = 1 << 20;
+
+// Approximate memory used by one vocabulary entry besides its characters:
+// the Word itself, the hash node and bucket of word2pos_
+const size_t kWordOverhead = sizeof(Word) + sizeof(pair<const string, int>)
+    + 2 * sizeof(void*);
+
+inline size_t WordMemory(const string &word) {
+  // the characters are stored twice, in vocab_ and as key of word2pos_
+  return kWordOverhead + 2 * word.size();
+}
+
+// Vocabulary file layout: magic, word number, train word count, then for
+// every word its byte length, the bytes and its frequency
+const char kVocabMagic[8] = {'W', 'V', 'V', 'O', 'C', 'A', 'B', '1'};
+
+template <typename T>
+bool ReadPOD(const vector<char> &buf, size_t &pos, T &value) {
+  if (pos + sizeof(T) > buf.size()) {
+    return false;
+  }
+  memcpy(&value, &buf[pos], sizeof(T));
+  pos += sizeof(T);
+  return true;
+}
+
 } // namespace
 
-Vocabulary::Vocabulary() : train_word_count_(0) {
+Vocabulary::Vocabulary()
+    : train_word_count_(0),
+      max_memory_(static_cast<size_t>(FLAGS_vocab_memory_mb) << 20),
+      memory_usage_(0),
+      min_reduce_(1) {
 }
 
 Vocabulary::~Vocabulary() = default;
@@ -33,60 +68,113 @@ Word &Vocabulary::operator[](size_t index) {
 }
 
 bool Vocabulary::AddWord(const string &word) {
-  if (word2pos_.find(word) == word2pos_.end()) {
+  auto iter = word2pos_.find(word);
+  if (iter == word2pos_.end()) {
     vocab_.emplace_back(word, 1);
     word2pos_[word] = vocab_.size() - 1;
+    memory_usage_ += WordMemory(word);
+    if (max_memory_ > 0 && memory_usage_ > max_memory_) {
+      PruneVocab();
+    }
   } else {
-    vocab_[word2pos_[word]].freq++;
+    vocab_[iter->second].freq++;
   }
   ++train_word_count_;
 
   return true;
 }
 
+// Drop the words seen no more than min_reduce_ times, raising the threshold
+// until the vocabulary fits in the memory limit again. The same strategy as
+// ReduceVocab in google word2vec, frequencies of the kept words are exact
+// only since the last pruning that could have removed them.
+void Vocabulary::PruneVocab() {
+  while (memory_usage_ > max_memory_ && !vocab_.empty()) {
+    size_t kept = 0;
+    memory_usage_ = 0;
+    for (size_t i = 0; i < vocab_.size(); ++i) {
+      if (vocab_[i].freq > min_reduce_) {
+        if (kept != i) {
+          vocab_[kept] = std::move(vocab_[i]);
+        }
+        memory_usage_ += WordMemory(vocab_[kept].word);
+        ++kept;
+      }
+    }
+    vocab_.erase(vocab_.begin() + kept, vocab_.end());
+    word2pos_.clear();
+    for (size_t i = 0; i < vocab_.size(); ++i) {
+      word2pos_[vocab_[i].word] = i;
+    }
+    LOG(INFO) << "Pruned words with frequency <= " << min_reduce_
+              << ", vocabulary size = " << vocab_.size() << endl;
+    ++min_reduce_;
+  }
+}
+
 // This is a clearer implementation of building Huffman Tree than google
 // word2vec
 void Vocabulary::HuffmanEncoding() {
+  const int vocab_size = vocab_.size();
+  if (vocab_size == 0) {
+    return;
+  }
+  // Leaves ordered by ascending frequency. The vocabulary is sorted in
+  // descending order after ReduceVocab, so we only need to walk it backward.
+  vector<int> leaves(vocab_size);
+  for (int i = 0; i < vocab_size; ++i) {
+    leaves[i] = vocab_size - 1 - i;
+  }
+  if (!is_sorted(vocab_.begin(), vocab_.end())) {
+    stable_sort(leaves.begin(), leaves.end(), [this](int a, int b) {
+      return vocab_[a].freq < vocab_[b].freq;
+    });
+  }
+
+  // Every word in vocabulary is a huffman tree node, the merged nodes are
+  // appended after them
   vector<HuffmanTreeNode> nodes;
-  // Heap structure for building huffman tree, min frequency pop out first
-  priority_queue<HuffmanTreeNode> heap;
-  // Firstly, every word in vocabulary is a huffman tree node
-  // Secondly, every tree node should put into a heap
-  for (const auto &w : vocab_) {
-    int node_idx = nodes.size();
-    nodes.emplace_back(w.freq, kNoParent, node_idx);
-    heap.push(nodes.back());
+  nodes.reserve(vocab_size * 2 - 1);
+  for (int i = 0; i < vocab_size; ++i) {
+    nodes.emplace_back(vocab_[i].freq, kNoParent, i);
   }
 
-  while (!heap.empty()) {
-    // retrieve 2 nodes from heap every time
-    const auto min_node1 = heap.top();
-    heap.pop();
-    if (heap.empty()) { //if heap is empty means huffman tree has built
-      break;
+  // Two-queue construction: the first queue is the sorted leaves, the second
+  // one is the merged nodes, which are created in non-decreasing frequency
+  // order. The minimum node is always at the front of one of them.
+  int leaf_pos = 0;
+  int inner_pos = vocab_size;
+  auto pop_min_node = [&]() {
+    if (leaf_pos < vocab_size && (inner_pos >= nodes.size()
+        || nodes[leaves[leaf_pos]].freq <= nodes[inner_pos].freq)) {
+      return leaves[leaf_pos++];
     }
-    const auto min_node2 = heap.top();
-    heap.pop();
+    return inner_pos++;
+  };
+
+  for (int i = 0; i < vocab_size - 1; ++i) {
+    // retrieve 2 minimum frequency nodes every time
+    const int min_node1 = pop_min_node();
+    const int min_node2 = pop_min_node();
 
     // merge two minimum frequency nodes to a new huffman tree node
     // at first its parent is -1
     int new_node_idx = nodes.size();
-    auto new_node = HuffmanTreeNode(min_node1.freq + min_node2.freq, kNoParent,
-                                    new_node_idx);
-    nodes.push_back(new_node);
-
-    heap.push(new_node);
+    nodes.emplace_back(nodes[min_node1].freq + nodes[min_node2].freq,
+                       kNoParent, new_node_idx);
     // assign Huffman code
-    nodes[min_node1.idx].code = 0;
-    nodes[min_node2.idx].code = 1;
+    nodes[min_node1].code = 0;
+    nodes[min_node2].code = 1;
     // assign parent index
-    nodes[min_node1.idx].parent = new_node_idx;
-    nodes[min_node2.idx].parent = new_node_idx;
+    nodes[min_node1].parent = new_node_idx;
+    nodes[min_node2].parent = new_node_idx;
   }
   nodes.back().code = 1;  // assign the huffman ROOT code
   // encoding every word in vocabulary
   const int root_index = nodes.back().idx;
-  for (int i = 0; i < vocab_.size(); ++i) {
+  for (int i = 0; i < vocab_size; ++i) {
+    vocab_[i].code.clear();
+    vocab_[i].output_node_id.clear();
     int idx = i;
     // Generate the Huffman code from leaf to root, it's the same as from
     // root to leaf. If idx equal to -1 means reach Huffman tree root
@@ -94,7 +182,7 @@ void Vocabulary::HuffmanEncoding() {
       vocab_[i].code.push_back(nodes[idx].code);
       // vocab's point is a Huffman code mapping to output layer
       // Huffman coding mapping just reflects the frequency information
-      vocab_[i].output_node_id.push_back(idx % vocab_.size());
+      vocab_[i].output_node_id.push_back(idx % vocab_size);
       idx = nodes[idx].parent;
     }
     /***************Below is a hidden TRICK!***************************
@@ -102,7 +190,7 @@ void Vocabulary::HuffmanEncoding() {
     * every word's huffman code must contains the huffman tree root!
     * if you loss the mapping of huffman tree root, the result is terrible!!
     ******************************************************************/
-    vocab_[i].output_node_id.push_back(root_index % vocab_.size());  // TRICK!
+    vocab_[i].output_node_id.push_back(root_index % vocab_size);  // TRICK!
 
     reverse(vocab_[i].code.begin(), vocab_[i].code.end());
     reverse(vocab_[i].output_node_id.begin(), vocab_[i].output_node_id.end());
@@ -113,9 +201,12 @@ void Vocabulary::HuffmanEncoding() {
 // Moreover, after sorting the vocabulary, the word->index hash need to be rebuild
 void Vocabulary::ReduceVocab() {
   printf("Reducing Vocabulary...\n");
-  sort(vocab_.begin(), vocab_.end());
+  // a vocabulary loaded by ReadVocab is sorted already
+  if (!is_sorted(vocab_.begin(), vocab_.end())) {
+    sort(vocab_.begin(), vocab_.end());
+  }
 
-  while (vocab_.back().freq < FLAGS_min_word_freq) {
+  while (!vocab_.empty() && vocab_.back().freq < FLAGS_min_word_freq) {
     vocab_.pop_back();
   }
   word2pos_.clear();
@@ -123,6 +214,10 @@ void Vocabulary::ReduceVocab() {
   for (int i = 0; i < vocab_.size(); ++i) {
     word2pos_[vocab_[i].word] = i;
   }
+  memory_usage_ = 0;
+  for (const auto &w : vocab_) {
+    memory_usage_ += WordMemory(w.word);
+  }
   LOG(INFO) << "Recuded Vocabulary Size = " << vocab_.size() << endl;
 }
 
@@ -137,26 +232,46 @@ int Vocabulary::GetWordIndex(const string &word) const {
 Vocabulary *Vocabulary::CreateVocabFromTrainFiles(const std::vector<std::string> &files) {
   Vocabulary* vocab = new Vocabulary();
   clock_t start = clock();
+  vector<char> buf(kReadBufferSize);
   for (const auto &f : files) {
     LOG(INFO) << "loading " << f.c_str() << endl;
-    FILE *fin = fopen(f.c_str(), "r");
-    if (fin == nullptr) {
+    // compressed files are decompressed on the fly
+    unique_ptr<InputStream> stream(InputStream::Open(f, 0, -1,
+                                                     DetectCompression(f)));
+    if (stream == nullptr) {
       LOG(ERROR) << "fail to open " << f << endl;
       continue;
     }
 
-    FileCloser fcloser(fin);
+    // split words the same way as ReadWord
     string word;
-    while (!feof(fin)) {
-      ReadWord(word, fin);
-      if (word.empty()) {
-        continue;
+    int64 n;
+    while ((n = stream->Read(&buf[0], buf.size())) > 0) {
+      for (int64 i = 0; i < n; ++i) {
+        const char ch = buf[i];
+        if (ch == '\r' || ch == '\t') {
+          continue;
+        }
+        if (ch != ' ' && ch != '\n') {
+          word.push_back(ch);
+          continue;
+        }
+        if (word.empty()) {
+          continue;
+        }
+        vocab->AddWord(word);
+        word.clear();
+        if (vocab->GetTrainWordCount() % 100000 == 0) {
+          printf("process %d K words\r", vocab->GetTrainWordCount() / 1000);
+          fflush(stdout);
+        }
       }
+    }
+    if (n < 0) {
+      LOG(ERROR) << "fail to read " << f << endl;
+    }
+    if (!word.empty()) {
       vocab->AddWord(word);
-      if (vocab->GetTrainWordCount() % 100000 == 0) {
-        printf("process %d K words\r", vocab->GetTrainWordCount() / 1000);
-        fflush(stdout);
-      }
     }
   }
 
@@ -168,3 +283,92 @@ Vocabulary *Vocabulary::CreateVocabFromTrainFiles(const std::vector<std::string>
 
   return vocab;
 }
+
+bool Vocabulary::SaveVocab(const std::string &file) const {
+  FILE *fo = fopen(file.c_str(), "wb");
+  if (fo == nullptr) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return false;
+  }
+  FileCloser fcloser(fo);
+
+  string buf(kVocabMagic, sizeof(kVocabMagic));
+  const uint64 word_num = vocab_.size();
+  const int64 train_word_count = train_word_count_;
+  buf.append(reinterpret_cast<const char*>(&word_num), sizeof(word_num));
+  buf.append(reinterpret_cast<const char*>(&train_word_count),
+             sizeof(train_word_count));
+  for (const auto &w : vocab_) {
+    const uint32 len = w.word.size();
+    const int32 freq = w.freq;
+    buf.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    buf.append(w.word);
+    buf.append(reinterpret_cast<const char*>(&freq), sizeof(freq));
+  }
+  if (fwrite(buf.data(), 1, buf.size(), fo) != buf.size()) {
+    LOG(ERROR) << "fail to write vocabulary to " << file << endl;
+    return false;
+  }
+  LOG(INFO) << "Saved " << vocab_.size() << " words to " << file << endl;
+
+  return true;
+}
+
+Vocabulary *Vocabulary::ReadVocab(const std::string &file) {
+  FILE *fin = fopen(file.c_str(), "rb");
+  if (fin == nullptr) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return nullptr;
+  }
+  FileCloser fcloser(fin);
+
+  // slurp the whole file, parsing from memory is much faster than fread
+  // word by word
+  vector<char> buf;
+  char chunk[1 << 16];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fin)) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+
+  size_t pos = 0;
+  uint64 word_num = 0;
+  int64 train_word_count = 0;
+  if (buf.size() < sizeof(kVocabMagic)
+      || memcmp(&buf[0], kVocabMagic, sizeof(kVocabMagic)) != 0) {
+    LOG(ERROR) << file << " is not a vocabulary file" << endl;
+    return nullptr;
+  }
+  pos += sizeof(kVocabMagic);
+  if (!ReadPOD(buf, pos, word_num) || !ReadPOD(buf, pos, train_word_count)) {
+    LOG(ERROR) << "truncated vocabulary file " << file << endl;
+    return nullptr;
+  }
+
+  unique_ptr<Vocabulary> vocab(new Vocabulary());
+  vocab->vocab_.reserve(word_num);
+  vocab->word2pos_.reserve(word_num);
+  for (uint64 i = 0; i < word_num; ++i) {
+    uint32 len = 0;
+    int32 freq = 0;
+    if (!ReadPOD(buf, pos, len) || pos + len > buf.size()) {
+      LOG(ERROR) << "truncated vocabulary file " << file << endl;
+      return nullptr;
+    }
+    string word(&buf[pos], len);
+    pos += len;
+    if (!ReadPOD(buf, pos, freq)) {
+      LOG(ERROR) << "truncated vocabulary file " << file << endl;
+      return nullptr;
+    }
+    vocab->word2pos_[word] = vocab->vocab_.size();
+    vocab->memory_usage_ += WordMemory(word);
+    vocab->vocab_.emplace_back(word, freq);
+  }
+  vocab->train_word_count_ = train_word_count;
+
+  printf("Vocabulary Size = %lu\nWords in Training File = %d\n",
+      vocab->Size(), vocab->GetTrainWordCount());
+
+  return vocab.release();
+}
@@ -58,6 +58,15 @@ class Vocabulary {
 
   static Vocabulary* CreateVocabFromTrainFiles(const std::vector<std::string> &files);
 
+  // Load a vocabulary written by SaveVocab, return nullptr on failure
+  static Vocabulary* ReadVocab(const std::string &file);
+
+  // Serialize words and frequencies so that later runs can skip the
+  // counting pass over the corpus
+  bool SaveVocab(const std::string &file) const;
+
+  // Build the Huffman tree with two queues, it is linear in vocabulary size
+  // when the vocabulary is already sorted by ReduceVocab
   void HuffmanEncoding();
 
   size_t Size() const {
@@ -74,7 +83,15 @@ class Vocabulary {
     return train_word_count_;
   }
 
+  // Limit the approximate memory used while counting words, low frequency
+  // words are pruned during the scan when it is exceeded. 0 means no limit.
+  void SetMaxMemory(size_t bytes) {
+    max_memory_ = bytes;
+  }
+
  private:
+  void PruneVocab();
+
   Vocabulary(const Vocabulary&);  // no copying!
 
   void operator=(const Vocabulary&);  // no copying!
@@ -84,6 +101,13 @@ class Vocabulary {
   std::vector<Word> vocab_;
 
   int train_word_count_;
+
+  size_t max_memory_;
+
+  size_t memory_usage_;
+
+  // words with frequency not greater than it are dropped by next pruning
+  int min_reduce_;
 };
 
 #endif // vocabulary.h
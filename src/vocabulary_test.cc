@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
 #include <string>
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
@@ -35,6 +38,63 @@ TEST(TestVocabulary, TestAddLargeWord) {
   ASSERT_EQ(tot_word, vocab[0].freq);
 }
 
+TEST(TestVocabulary, TestSaveAndReadVocab) {
+  Vocabulary vocab;
+  for (int i = 0; i < 3; ++i) {
+    vocab.AddWord("wordvec");
+  }
+  vocab.AddWord("chenzeyu");
+  ASSERT_TRUE(vocab.SaveVocab("vocabulary_test.vocab"));
+
+  unique_ptr<Vocabulary> loaded(Vocabulary::ReadVocab("vocabulary_test.vocab"));
+  ASSERT_TRUE(loaded != nullptr);
+  ASSERT_EQ(vocab.Size(), loaded->Size());
+  ASSERT_EQ(vocab.GetTrainWordCount(), loaded->GetTrainWordCount());
+  ASSERT_EQ(0, loaded->GetWordIndex("wordvec"));
+  ASSERT_EQ(1, loaded->GetWordIndex("chenzeyu"));
+  ASSERT_EQ(3, (*loaded)[0].freq);
+  remove("vocabulary_test.vocab");
+}
+
+TEST(TestVocabulary, TestHuffmanEncoding) {
+  Vocabulary vocab;
+  // word i appears (i + 1) times
+  for (int i = 0; i < 100; ++i) {
+    for (int j = 0; j <= i; ++j) {
+      vocab.AddWord("w" + to_string(i));
+    }
+  }
+  vocab.ReduceVocab();
+  vocab.HuffmanEncoding();
+  for (int i = 0; i + 1 < vocab.Size(); ++i) {
+    // higher frequency word never has a longer code
+    ASSERT_LE(vocab[i].code.size(), vocab[i + 1].code.size());
+    ASSERT_EQ(vocab[i].code.size() + 1, vocab[i].output_node_id.size());
+  }
+  // the codes form a prefix-free set
+  for (int i = 0; i < vocab.Size(); ++i) {
+    for (int j = i + 1; j < vocab.Size(); ++j) {
+      const auto &a = vocab[i].code;
+      const auto &b = vocab[j].code;
+      ASSERT_FALSE(equal(a.begin(), a.end(), b.begin()));
+    }
+  }
+}
+
+TEST(TestVocabulary, TestMemoryLimit) {
+  Vocabulary vocab;
+  vocab.SetMaxMemory(64 << 10);
+  for (int i = 0; i < 100000; ++i) {
+    vocab.AddWord("rare" + to_string(i));
+    vocab.AddWord("common");
+  }
+  ASSERT_LT(vocab.Size(), 2000);
+  ASSERT_EQ(200000, vocab.GetTrainWordCount());
+  int idx = vocab.GetWordIndex("common");
+  ASSERT_GE(idx, 0);
+  ASSERT_GT(vocab[idx].freq, 90000);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest( &argc, argv );
   return RUN_ALL_TESTS();
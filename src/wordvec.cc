@@ -1,9 +1,17 @@
 #include "wordvec.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 #include <omp.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "model_delta.h"
+#include "projection.h"
 
 using namespace std;
 
@@ -13,70 +21,384 @@ const real start_alpha_ = 0.025;
 inline real Sigmoid(double x) {
   return exp(x) / (1 + exp(x));
 }
+
+// number of rows formatted by one thread at a time when saving vectors
+const int kSaveBlockRows = 1024;
+
+// the header page of a mapped model file, keeps the matrix page aligned
+const size_t kMappedHeaderSize = 4096;
+
+// hash bucket k is saved as the word bucket_<k>
+const char kBucketPrefix[] = "bucket_";
+
+// The window of one token, drawn from [1, window] when next_random is given
+inline int TokenWindow(int window, uint64* next_random) {
+  if (next_random == nullptr || window <= 1) {
+    return window;
+  }
+  return 1 + (NextRandom(*next_random) >> 16) % window;
+}
+
+// Scale vec to unit length, zero vectors are kept
+void NormalizeRow(real* vec, int n) {
+  double len = 0;
+  for (int i = 0; i < n; ++i) {
+    len += vec[i] * vec[i];
+  }
+  len = sqrt(len);
+  if (len > 0) {
+    for (int i = 0; i < n; ++i) {
+      vec[i] /= len;
+    }
+  }
+}
 }
 
 WordVec::WordVec() {
   syn_in_ = syn_out_ = nullptr;
   word_count_total_ = 0;
+  train_time_ = 0;
+  read_time_ = read_wait_time_ = 0;
+  SelectKernels();
 }
 
 WordVec::WordVec(const Options &options) : opt_(options) {
   syn_in_ = syn_out_ = nullptr;
   word_count_total_ = 0;
+  train_time_ = 0;
+  read_time_ = read_wait_time_ = 0;
+  SelectKernels();
 }
 
 WordVec::~WordVec() {
-  delete[] syn_in_;
-  delete[] syn_out_;
+  // mapped tables are released by their MappedTable
+  if (mapped_in_ == nullptr) {
+    delete[] syn_in_;
+  }
+  if (mapped_out_ == nullptr) {
+    delete[] syn_out_;
+  }
 }
 
 void WordVec::InitializeNetwork() {
   CHECK(voc_ != nullptr);
-  // Initialize synapses for input layer
-  syn_in_ = new real[voc_->Size() * opt_.hidden_layer_size];
-
-  for (int h = 0; h < opt_.hidden_layer_size; ++h) {
-    for (int xi = 0; xi < voc_->Size(); xi++) {
-      // use random value (0,1) to initialize the input synapses
-      syn_in_[xi * opt_.hidden_layer_size + h] = RandReal();
+  if (mapped_in_ == nullptr) {
+    delete[] syn_in_;
+  }
+  if (mapped_out_ == nullptr) {
+    delete[] syn_out_;
+  }
+  syn_in_ = syn_out_ = nullptr;
+  mapped_in_.reset();
+  mapped_out_.reset();
+  // the hash bucket rows follow the vocabulary in the input layer only
+  const size_t in_rows = voc_->Size() + opt_.hash_buckets;
+  const size_t in_size = in_rows * opt_.hidden_layer_size;
+  const size_t table_size = static_cast<size_t>(voc_->Size())
+      * opt_.hidden_layer_size;
+  if (!opt_.mapped_model_file.empty()) {
+    if (!MapNetwork()) {
+      LOG(FATAL) << "fail to map tables to " << opt_.mapped_model_file << endl;
+    }
+  } else {
+    // Initialize synapses for input layer
+    syn_in_ = new real[in_size];
+    // Initialize synapses for output layer
+    if (opt_.use_hierachical_softmax) {
+      syn_out_ = new real[table_size];
+      memset(syn_out_, 0, table_size * sizeof(real));
     }
   }
 
-  // Initialize synapses for output layer
-  if (opt_.use_hierachical_softmax) {
-    syn_out_ = new real[voc_->Size() * opt_.hidden_layer_size];
-    memset(syn_out_, 0, voc_->Size() * opt_.hidden_layer_size * sizeof(real));
+  // row by row, so every page is touched once when the table is mapped
+  for (size_t i = 0; i < in_size; ++i) {
+    // use random value (0,1) to initialize the input synapses
+    syn_in_[i] = RandReal();
+  }
+  dirty_rows_.clear();
+  in_init_model_.clear();
+  if (!opt_.init_model_file.empty()) {
+    if (!LoadInitModel()) {
+      LOG(FATAL) << "fail to load initial model " << opt_.init_model_file
+                 << endl;
+    }
+    dirty_rows_.assign((in_rows + 63) / 64, 0);
   }
 // TODO: Negative Sampling Network Initialize
 // Negative Samlpling is one of the trick of word2vec, but will not improve
 // the result greatly. Turning negative sampling off is he default config
 }
 
-void WordVec::Train(const vector<string> &files) {
-  //loading vocabulary needs to read all files
-  voc_.reset(Vocabulary::CreateVocabFromTrainFiles(files));
-  voc_->ReduceVocab();
-  voc_->HuffmanEncoding();
+// The output layer is not saved, so it still starts from zero
+bool WordVec::LoadInitModel() {
+  in_init_model_.assign(voc_->Size() + opt_.hash_buckets, false);
+  long long row_num = 0, known = 0;
+  if (!LoadInitRows(opt_.init_model_file, false, row_num, known)) {
+    return false;
+  }
+  LOG(INFO) << "Initialized " << known << " of " << voc_->Size()
+            << " words from " << opt_.init_model_file << endl;
 
-  InitializeNetwork();
-  word_count_total_ = 0;
+  const string bucket_file = opt_.init_model_file + kBucketFileSuffix;
+  if (opt_.hash_buckets == 0 || access(bucket_file.c_str(), F_OK) != 0) {
+    return true;
+  }
+  if (!LoadInitRows(bucket_file, true, row_num, known)) {
+    return false;
+  }
+  // the words hash to other buckets if their number changes
+  if (row_num != opt_.hash_buckets) {
+    LOG(ERROR) << bucket_file << " has " << row_num << " buckets instead of "
+               << opt_.hash_buckets << endl;
+    return false;
+  }
+  LOG(INFO) << "Initialized " << known << " hash buckets from "
+            << bucket_file << endl;
+  return true;
+}
+
+bool WordVec::LoadInitRows(const string &file, bool buckets,
+                           long long &row_num, long long &known) {
+  FILE* fi = fopen(file.c_str(), "rb");
+  if (fi == nullptr) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return false;
+  }
+  FileCloser fcloser(fi);
+  int dim = 0;
+  if (fscanf(fi, "%lld %d", &row_num, &dim) != 2
+      || dim != opt_.hidden_layer_size) {
+    LOG(ERROR) << file << " is not a binary model of "
+               << opt_.hidden_layer_size << " dimensions" << endl;
+    return false;
+  }
+  const size_t prefix_len = strlen(kBucketPrefix);
+  vector<real> vec(dim);
+  string word;
+  known = 0;
+  for (long long i = 0; i < row_num; ++i) {
+    // the row is "<word> <dim reals>\n"
+    int ch = fgetc(fi);
+    while (ch == '\n' || ch == ' ') {
+      ch = fgetc(fi);
+    }
+    word.clear();
+    for (; ch != EOF && ch != ' '; ch = fgetc(fi)) {
+      word.push_back(ch);
+    }
+    if (word.empty() || fread(&vec[0], sizeof(real), dim, fi) != dim) {
+      LOG(ERROR) << "truncated model " << file << endl;
+      return false;
+    }
+    int idx = -1;
+    if (!buckets) {
+      idx = voc_->GetWordIndex(word);
+    } else if (word.compare(0, prefix_len, kBucketPrefix) == 0) {
+      const int bucket = atoi(word.c_str() + prefix_len);
+      if (bucket >= 0 && bucket < opt_.hash_buckets) {
+        idx = voc_->Size() + bucket;
+      }
+    }
+    if (idx >= 0) {
+      memcpy(syn_in_ + static_cast<size_t>(idx) * dim, &vec[0],
+             dim * sizeof(real));
+      in_init_model_[idx] = true;
+      ++known;
+    }
+  }
+  return true;
+}
+
+string WordVec::RowName(size_t row) const {
+  if (row < voc_->Size()) {
+    return (*voc_)[row].word;
+  }
+  return kBucketPrefix + to_string(row - voc_->Size());
+}
+
+bool WordVec::MapNetwork() {
+  const size_t rows = voc_->Size();
+  mapped_in_.reset(new MappedTable());
+  if (!mapped_in_->Create(opt_.mapped_model_file, kMappedHeaderSize,
+                          rows + opt_.hash_buckets, opt_.hidden_layer_size,
+                          true)) {
+    return false;
+  }
+  syn_in_ = mapped_in_->Data();
+  if (opt_.use_hierachical_softmax) {
+    // the output layer is not saved, its pages only need somewhere to go
+    // when they are evicted. A fresh sparse file reads back as zeros.
+    mapped_out_.reset(new MappedTable());
+    if (!mapped_out_->Create(opt_.mapped_model_file + ".out.tmp", 0, rows,
+                             opt_.hidden_layer_size, false)) {
+      return false;
+    }
+    syn_out_ = mapped_out_->Data();
+  }
+  LOG(INFO) << "Mapped " << rows << " x " << opt_.hidden_layer_size
+            << " tables to " << opt_.mapped_model_file << endl;
+  return true;
+}
+
+// Pick the training kernels specialized for the hidden layer size, or the
+// generic ones when there is no instantiation for it
+void WordVec::SelectKernels() {
+  const bool sliding = opt_.incremental_context > 0;
+  cbow_kernel_ = sliding ? &WordVec::TrainCBOWSliding<0>
+                         : &WordVec::TrainCBOWModel<0>;
+  skipgram_kernel_ = &WordVec::TrainSkipGramModel<0>;
+  cbow_block_kernel_ = &WordVec::TrainCBOWBlock<0>;
+  skipgram_block_kernel_ = &WordVec::TrainSkipGramBlock<0>;
+  if (!opt_.use_specialized_kernel) {
+    return;
+  }
+  switch (opt_.hidden_layer_size) {
+#define WORDVEC_SPECIALIZE_KERNEL(size)                            \
+    case size:                                                     \
+      cbow_kernel_ = sliding ? &WordVec::TrainCBOWSliding<size>    \
+                             : &WordVec::TrainCBOWModel<size>;     \
+      skipgram_kernel_ = &WordVec::TrainSkipGramModel<size>;       \
+      cbow_block_kernel_ = &WordVec::TrainCBOWBlock<size>;         \
+      skipgram_block_kernel_ = &WordVec::TrainSkipGramBlock<size>; \
+      break;
+    WORDVEC_SPECIALIZE_KERNEL(50)
+    WORDVEC_SPECIALIZE_KERNEL(100)
+    WORDVEC_SPECIALIZE_KERNEL(128)
+    WORDVEC_SPECIALIZE_KERNEL(200)
+    WORDVEC_SPECIALIZE_KERNEL(256)
+    WORDVEC_SPECIALIZE_KERNEL(300)
+#undef WORDVEC_SPECIALIZE_KERNEL
+    default:
+      break;
+  }
+}
+
+bool WordVec::Train(const vector<string> &files) {
+  return TrainModels(vector<WordVec*>(1, this), files);
+}
+
+bool WordVec::TrainModels(const vector<WordVec*> &models,
+                          const vector<string> &files) {
+  CHECK(!models.empty());
+  WordVec* first = models[0];
+  const Options &opt = first->opt_;
+  //loading vocabulary needs to read all files, unless it was saved before
+  shared_ptr<Vocabulary> voc;
+  if (!opt.read_vocab_file.empty()) {
+    voc.reset(Vocabulary::ReadVocab(opt.read_vocab_file));
+    if (voc == nullptr) {
+      LOG(FATAL) << "fail to read vocabulary " << opt.read_vocab_file << endl;
+      return false;
+    }
+  } else {
+    voc.reset(Vocabulary::CreateVocabFromTrainFiles(files));
+  }
+  voc->ReduceVocab();
+  if (!opt.save_vocab_file.empty()) {
+    voc->SaveVocab(opt.save_vocab_file);
+  }
+  voc->HuffmanEncoding();
+
+  for (WordVec* model : models) {
+    // the models train the same sentences, so they agree on the word ids
+    CHECK_EQ(model->opt_.hash_buckets, opt.hash_buckets);
+    model->voc_ = voc;
+    model->InitializeNetwork();
+    model->SelectKernels();
+    model->word_count_total_ = 0;
+  }
+  FileScheduler scheduler(files, opt.shard_size);
+  LOG(INFO) << "Split " << files.size() << " files into " << scheduler.Size()
+            << " shards" << endl;
+  const int thread_num = omp_get_max_threads();
+  vector<double> busy_time(thread_num, 0), idle_time(thread_num, 0);
+  first->read_time_ = first->read_wait_time_ = 0;
+  struct rusage usage_start;
+  getrusage(RUSAGE_SELF, &usage_start);
   double start = omp_get_wtime();
+  // a shard that could not be read stops the training
+  atomic<bool> failed(false);
   // iterate the corpus
-  for (int epoch = 0; epoch < opt_.iter; ++epoch) {
-#pragma omp parallel for
-    for (int i = 0; i < files.size(); ++i) {
-      TrainModelWithFile(files[i]);
+  for (int epoch = 0; epoch < opt.iter && !failed; ++epoch) {
+    scheduler.Reset();
+#pragma omp parallel
+    {
+      const int tid = omp_get_thread_num();
+      WorkItem item;
+      // every idle thread takes the next largest shard
+      while (!failed && scheduler.Next(item)) {
+        double item_start = omp_get_wtime();
+        if (!TrainShard(models, item)) {
+          failed = true;
+        }
+        busy_time[tid] += omp_get_wtime() - item_start;
+      }
+      double finish = omp_get_wtime();
+#pragma omp barrier
+      idle_time[tid] += omp_get_wtime() - finish;
     }
   }
   double cost_time = omp_get_wtime() - start;
+  for (WordVec* model : models) {
+    model->train_time_ = cost_time;
+  }
   printf("Training Time: %lf sec\n", cost_time);
   printf("Training Speed: words/thread/sec: %.1fk\n",
-      voc_->GetTrainWordCount() / cost_time / opt_.thread_num / 1000);
+      voc->GetTrainWordCount() / cost_time / opt.thread_num / 1000);
+  if (models.size() > 1) {
+    printf("Trained %lu models in one pass\n", models.size());
+  }
+  for (int t = 0; t < thread_num; ++t) {
+    printf("Thread %d: busy %.2lf sec, idle %.2lf sec\n", t, busy_time[t],
+           idle_time[t]);
+  }
+  // overlap is the share of reading time hidden behind training
+  const double read_time = first->read_time_;
+  const double wait_time = first->read_wait_time_;
+  printf("Reading: %.2lf sec, waited for data: %.2lf sec, overlap: %.1f%%\n",
+         read_time, wait_time,
+         read_time > 0 ? max(0.0, 1 - wait_time / read_time) * 100 : 100.0);
+  if (!opt.mapped_model_file.empty()) {
+    struct rusage usage_end;
+    getrusage(RUSAGE_SELF, &usage_end);
+    printf("Page faults: major %ld, minor %ld\n",
+           usage_end.ru_majflt - usage_start.ru_majflt,
+           usage_end.ru_minflt - usage_start.ru_minflt);
+    for (WordVec* model : models) {
+      model->ReportResidency();
+    }
+  }
+  return !failed;
+}
+
+// The vocabulary is sorted by frequency, so the input rows trained most
+// often sit together at the head of the table. In the output table the
+// hottest rows are the inner nodes just below the Huffman root, at the tail
+// (see InitHotRows). Their pages are the ones that should stay resident,
+// report that for the hot rows and for the whole table.
+void WordVec::ReportResidency() const {
+  const size_t rows = voc_->Size();
+  const size_t head = max<size_t>(1, rows / 100);
+  if (mapped_in_ != nullptr) {
+    printf("Input table resident: %.1f%%, top 1%% rows: %.1f%%\n",
+           mapped_in_->Residency(0, rows) * 100,
+           mapped_in_->Residency(0, head) * 100);
+  }
+  if (mapped_out_ != nullptr) {
+    // the root is row rows - 2, row rows - 1 is never used
+    const size_t inner_end = rows > 1 ? rows - 1 : rows;
+    const size_t hot_begin = inner_end > head ? inner_end - head : 0;
+    printf("Output table resident: %.1f%%, top 1%% rows: %.1f%%\n",
+           mapped_out_->Residency(0, rows) * 100,
+           mapped_out_->Residency(hot_begin, inner_end) * 100);
+  }
 }
 
 // Training Continous Bag-of-Words model with one sentence, alpha is the learning rate
+template <int kHiddenSize>
 void WordVec::TrainCBOWModel(const vector<int> &sentence, real neu1[],
-    real neu1e[], int window_size, real alpha) {
+    real neu1e[], int window_size, real alpha, HotRows* hot,
+    uint64* next_random) {
   CHECK(voc_ != nullptr);
   CHECK(syn_in_ != nullptr);
   CHECK(syn_out_ != nullptr);
@@ -84,85 +406,210 @@ void WordVec::TrainCBOWModel(const vector<int> &sentence, real neu1[],
   int sentence_len = sentence.size();
   //iterate every word in a sentence
   for (int w_target_idx = 0; w_target_idx < sentence_len; ++w_target_idx) {
-    // curr points to the word to be predict
-    int target_word = sentence[w_target_idx];
+    TrainCBOWWord<kHiddenSize>(sentence, w_target_idx, neu1, neu1e,
+                               TokenWindow(window_size, next_random), alpha,
+                               hot);
+  }
+}
 
-    // determine sentence windows range w_left and w_right
-    int w_left = max(0, w_target_idx - window_size);
-    int w_right = min(sentence_len - 1, w_target_idx + window_size);
-    // clear neu1 and neu1e when predicted words change
-    memset(neu1, 0, opt_.hidden_layer_size * sizeof(real));
-    memset(neu1e, 0, opt_.hidden_layer_size * sizeof(real));
+template <int kHiddenSize>
+inline void WordVec::TrainCBOWWord(const vector<int> &sentence,
+    int w_target_idx, real neu1[], real neu1e[], int window_size, real alpha,
+    HotRows* hot) {
+  // a compile-time constant when specialized, so the loops below get fully
+  // unrolled and vectorized without remainder handling
+  const int layer_size = kHiddenSize > 0 ? kHiddenSize : opt_.hidden_layer_size;
+  int sentence_len = sentence.size();
 
-    // update from input layer -> hidden layer
-    for (int w = w_left; w <= w_right; ++w) {
-      if (w == w_target_idx) {
-        continue; // if w position equal to the target word index, skip it
+  // determine sentence windows range w_left and w_right
+  int w_left = max(0, w_target_idx - window_size);
+  int w_right = min(sentence_len - 1, w_target_idx + window_size);
+  // clear neu1 when predicted words change
+  memset(neu1, 0, layer_size * sizeof(real));
+
+  // update from input layer -> hidden layer
+  for (int w = w_left; w <= w_right; ++w) {
+    if (w == w_target_idx) {
+      continue; // if w position equal to the target word index, skip it
+    }
+    const size_t xi = static_cast<size_t>(sentence[w]) * layer_size;
+    for (int h = 0; h < layer_size; h++) {
+      neu1[h] += syn_in_[h + xi];
+    }
+  }
+  // the hidden layer is the mean of the context words, whose number varies
+  // with the window and the sentence boundaries. Like word2vec every context
+  // word then gets the whole error.
+  const int context_num = w_right - w_left;
+  if (context_num == 0) {
+    return;
+  }
+  const real scale = 1.0 / context_num;
+  for (int h = 0; h < layer_size; h++) {
+    neu1[h] *= scale;
+  }
+  TrainCBOWOutput<kHiddenSize>(sentence, w_target_idx, w_left, w_right, neu1,
+                               neu1e, alpha, hot);
+}
+
+// Train the prediction of the target from the hidden layer neu1, then the
+// context words [w_left, w_right] with the error of the hidden layer
+template <int kHiddenSize>
+inline void WordVec::TrainCBOWOutput(const vector<int> &sentence,
+    int w_target_idx, int w_left, int w_right, const real neu1[],
+    real neu1e[], real alpha, HotRows* hot) {
+  const int layer_size = kHiddenSize > 0 ? kHiddenSize : opt_.hidden_layer_size;
+  // curr points to the word to be predict
+  int target_word = sentence[w_target_idx];
+  memset(neu1e, 0, layer_size * sizeof(real));
+  // a hash bucket has no Huffman code, it is only trained as context
+  if (target_word >= voc_->Size()) {
+    return;
+  }
+  // Hierachical softmax
+  if (opt_.use_hierachical_softmax) {
+    // iterate every Huffman code of the word to be predict
+    for (int c_idx = 0; c_idx < (*voc_)[target_word].code.size(); ++c_idx) {
+      real f = 0;
+      real* out = OutputRow(
+          (*voc_)[target_word].output_node_id[c_idx], layer_size, hot);
+      for (int h = 0; h < layer_size; ++h) {
+        f += neu1[h] * out[h];
       }
-      int xi = sentence[w] * opt_.hidden_layer_size;
-      for (int h = 0; h < opt_.hidden_layer_size; h++) {
-        neu1[h] += syn_in_[h + xi];
+
+      f = Sigmoid(f);
+      //real gradient = (1 - _voc[target_word].code[c_idx] - f) ;
+      real gradient = (*voc_)[target_word].code[c_idx] - f;
+      for (int h = 0; h < layer_size; ++h) {
+        neu1e[h] += alpha * gradient * out[h];
+      }
+      for (int h = 0; h < layer_size; ++h) {
+        out[h] += alpha * gradient * neu1[h];
       }
     }
-    // Hierachical softmax
-    if (opt_.use_hierachical_softmax) {
-      // iterate every Huffman code of the word to be predict
-      for (int c_idx = 0; c_idx < (*voc_)[target_word].code.size(); ++c_idx) {
-        real f = 0;
-        int xo = (*voc_)[target_word].output_node_id[c_idx] * opt_.hidden_layer_size;
-        for (int h = 0; h < opt_.hidden_layer_size; ++h) {
-          f += neu1[h] * syn_out_[h + xo];
-        }
+  }
+  // TODO: Negative Sampling
+  // update from hidden layer -> input layer
+  for (int w = w_left; w <= w_right; ++w) {
+    if (w == w_target_idx) {
+      continue; // if w position equal to curr, skip it
+    }
+    int word_idx = sentence[w];
+    for (int h = 0; h < layer_size; h++) {
+      syn_in_[h + static_cast<size_t>(word_idx) * layer_size] += neu1e[h];
+    }
+    MarkDirty(word_idx);
+  }
+}
 
-        f = Sigmoid(f);
-        //real gradient = (1 - _voc[target_word].code[c_idx] - f) ;
-        real gradient = (*voc_)[target_word].code[c_idx] - f;
-        for (int h = 0; h < opt_.hidden_layer_size; ++h) {
-          neu1e[h] += alpha * gradient * syn_out_[h + xo];
-        }
-        for (int h = 0; h < opt_.hidden_layer_size; ++h) {
-          syn_out_[h + xo] += alpha * gradient * neu1[h];
-        }
-      }
+// Same as TrainCBOWModel, but the sum of the context rows is kept in
+// neu1[layer_size, 2 * layer_size) while the window slides: the rows entering
+// it are added, the ones leaving it subtracted, and the update of the context
+// rows is added too. Repeated words and other threads make the sum drift
+// from the rows, so it is recomputed every incremental_context targets.
+template <int kHiddenSize>
+void WordVec::TrainCBOWSliding(const vector<int> &sentence, real neu1[],
+    real neu1e[], int window_size, real alpha, HotRows* hot,
+    uint64* next_random) {
+  CHECK(voc_ != nullptr);
+  CHECK(syn_in_ != nullptr);
+  CHECK(syn_out_ != nullptr);
+  const int layer_size = kHiddenSize > 0 ? kHiddenSize : opt_.hidden_layer_size;
+  real* sum = neu1 + layer_size;  // rows of positions [left, right]
+  int left = 0;
+  int right = -1;
+  int exact_age = 0;  // targets trained since the sum was computed exactly
+
+  int sentence_len = sentence.size();
+  for (int w_target_idx = 0; w_target_idx < sentence_len; ++w_target_idx) {
+    const int window = TokenWindow(window_size, next_random);
+    const int w_left = max(0, w_target_idx - window);
+    const int w_right = min(sentence_len - 1, w_target_idx + window);
+    const int context_num = w_right - w_left;
+    if (context_num == 0) {
+      continue;
     }
-    // TODO: Negative Sampling
-    // update from hidden layer -> input layer
-    for (int w = w_left; w <= w_right; ++w) {
-      if (w == w_target_idx) {
-        continue; // if w position equal to curr, skip it
-      }
-      int word_idx = sentence[w];
-      for (int h = 0; h < opt_.hidden_layer_size; h++) {
-        syn_in_[h + word_idx * opt_.hidden_layer_size] += neu1e[h];
+    if (right < left || w_left > right || w_right < left
+        || exact_age >= opt_.incremental_context) {
+      memset(sum, 0, layer_size * sizeof(real));
+      for (int w = w_left; w <= w_right; ++w) {
+        AddRow<kHiddenSize>(sum, sentence[w], 1);
       }
+      left = w_left;
+      right = w_right;
+      exact_age = 0;
+    }
+    for (; left < w_left; ++left) {
+      AddRow<kHiddenSize>(sum, sentence[left], -1);
+    }
+    for (; left > w_left; --left) {
+      AddRow<kHiddenSize>(sum, sentence[left - 1], 1);
+    }
+    for (; right < w_right; ++right) {
+      AddRow<kHiddenSize>(sum, sentence[right + 1], 1);
+    }
+    for (; right > w_right; --right) {
+      AddRow<kHiddenSize>(sum, sentence[right], -1);
     }
+    ++exact_age;
+
+    // the window includes the target, take it out of the mean
+    const real* target = syn_in_
+        + static_cast<size_t>(sentence[w_target_idx]) * layer_size;
+    const real scale = 1.0 / context_num;
+    for (int h = 0; h < layer_size; h++) {
+      neu1[h] = (sum[h] - target[h]) * scale;
+    }
+    TrainCBOWOutput<kHiddenSize>(sentence, w_target_idx, w_left, w_right,
+                                 neu1, neu1e, alpha, hot);
+    // every context row got neu1e
+    for (int h = 0; h < layer_size; h++) {
+      sum[h] += neu1e[h] * context_num;
+    }
+  }
+}
+
+template <int kHiddenSize>
+inline void WordVec::AddRow(real sum[], int word, real weight) const {
+  const int layer_size = kHiddenSize > 0 ? kHiddenSize : opt_.hidden_layer_size;
+  const real* row = syn_in_ + static_cast<size_t>(word) * layer_size;
+  for (int h = 0; h < layer_size; h++) {
+    sum[h] += weight * row[h];
   }
 }
 
 // Training Skip-Gram model with one sentence, alpha is the learning rate
+template <int kHiddenSize>
 void WordVec::TrainSkipGramModel(const vector<int> &sentence, real neu1e[],
-    int window_size, real alpha) {
+    int window_size, real alpha, HotRows* hot, uint64* next_random) {
   CHECK(voc_ != nullptr);
   CHECK(syn_in_ != nullptr);
   CHECK(syn_out_ != nullptr);
+  // a compile-time constant when specialized, so the loops below get fully
+  // unrolled and vectorized without remainder handling
+  const int layer_size = kHiddenSize > 0 ? kHiddenSize : opt_.hidden_layer_size;
 
   int sentence_len = sentence.size();
   //iterate every word in sentence
   for (int w_input_idx = 0; w_input_idx < sentence_len; ++w_input_idx) {
     int word_input = sentence[w_input_idx];
 
-    int xi = word_input * opt_.hidden_layer_size;
+    const size_t xi = static_cast<size_t>(word_input) * layer_size;
     // determine sentence windows range w_left and w_right
-    int w_left = max(0, w_input_idx - window_size);
-    int w_right = min(sentence_len - 1, w_input_idx + window_size);
+    const int window = TokenWindow(window_size, next_random);
+    int w_left = max(0, w_input_idx - window);
+    int w_right = min(sentence_len - 1, w_input_idx + window);
     // clear neu1 and neu1e when predict words change
 
     for (int w = w_left; w <= w_right; ++w) {
       if (w == w_input_idx) {
         continue; // if w position equal to the target word index, skip it
       }
-      memset(neu1e, 0, opt_.hidden_layer_size * sizeof(real));
       int target_word = sentence[w];
+      if (target_word >= voc_->Size()) {
+        continue; // hash buckets are never predicted
+      }
+      memset(neu1e, 0, layer_size * sizeof(real));
 
       // hierachical softmax
       if (opt_.use_hierachical_softmax) {
@@ -170,113 +617,533 @@ void WordVec::TrainSkipGramModel(const vector<int> &sentence, real neu1e[],
         for (int c_idx = 0; c_idx < (*voc_)[target_word].code.size();
              ++c_idx) {
           real f = 0;
-          int xo = (*voc_)[target_word].output_node_id[c_idx] * opt_.hidden_layer_size;
-          for (int h = 0; h < opt_.hidden_layer_size; ++h) {
-            f += syn_in_[h + xi] * syn_out_[h + xo];
+          real* out = OutputRow(
+              (*voc_)[target_word].output_node_id[c_idx], layer_size, hot);
+          for (int h = 0; h < layer_size; ++h) {
+            f += syn_in_[h + xi] * out[h];
           }
 
           f = Sigmoid(f);
           // the gradient formular for word2vec
           real gradient = (1 - (*voc_)[target_word].code[c_idx] - f);
-          for (int h = 0; h < opt_.hidden_layer_size; ++h) {
-            neu1e[h] += alpha * gradient * syn_out_[h + xo];
+          for (int h = 0; h < layer_size; ++h) {
+            neu1e[h] += alpha * gradient * out[h];
           }
-          for (int h = 0; h < opt_.hidden_layer_size; ++h) {
-            syn_out_[h + xo] += alpha * gradient * syn_in_[h + xi];
+          for (int h = 0; h < layer_size; ++h) {
+            out[h] += alpha * gradient * syn_in_[h + xi];
           }
         }
       }
       // hidden -> input
-      for (int h = 0; h < opt_.hidden_layer_size; ++h)
+      for (int h = 0; h < layer_size; ++h)
         syn_in_[h + xi] += neu1e[h];
+      MarkDirty(word_input);
     }
   }
 }
 
-void WordVec::TrainModelWithFile(const string &file_name) {
-  int window = 5;
-  real alpha = start_alpha_;
-  // variable for statistic
-  int word_count_curr_thread = 0, last_word_count_curr_thread = 0;
-  FILE *fi = fopen(file_name.c_str(), "r");
-  FileCloser fcloser(fi);
-  if (fi == NULL) {
-    LOG(FATAL) << "No such training file: " << file_name << endl;
+// Predictions are sorted by target word, which makes the ones sharing a
+// Huffman path adjacent. Neighbours in the frequency sorted vocabulary are
+// close in the Huffman tree too, so consecutive paths share their prefix.
+template <int kHiddenSize>
+void WordVec::TrainCBOWBlock(const SentenceBatch &batch, int begin, int end,
+    int window_size, ShardState &state) {
+  // key: target word in the high half, position in the block in the low half
+  state.pairs.clear();
+  state.starts.clear();
+  int position = 0;
+  for (int s = begin; s < end; ++s) {
+    const vector<int> &sentence = batch.sentences[s];
+    state.starts.push_back(position);
+    for (int w = 0; w < sentence.size(); ++w, ++position) {
+      if (sentence[w] < voc_->Size()) {
+        state.pairs.push_back(static_cast<uint64>(sentence[w]) << 32
+                              | position);
+      }
+    }
   }
+  sort(state.pairs.begin(), state.pairs.end());
 
-  // Initialize neuron and neuron error
-  real* neu1 = new real[opt_.hidden_layer_size];
-  real* neu1e = new real[opt_.hidden_layer_size];
+  for (const uint64 pair : state.pairs) {
+    const int position = static_cast<uint32>(pair);
+    const int s = upper_bound(state.starts.begin(), state.starts.end(),
+                              position) - state.starts.begin() - 1;
+    const int window = opt_.random_window
+        ? TokenWindow(window_size, &state.next_random) : window_size;
+    TrainCBOWWord<kHiddenSize>(batch.sentences[begin + s],
+                               position - state.starts[s], &state.neu1[0],
+                               &state.neu1e[0], window, state.alpha,
+                               state.hot);
+  }
+}
 
-  vector<int> sentence;
-  string word;
+// Pairs are sorted by input word, then by target word. The input row is
+// copied once per group and trained in the copy, its accumulated update is
+// written back when the group ends.
+template <int kHiddenSize>
+void WordVec::TrainSkipGramBlock(const SentenceBatch &batch, int begin,
+    int end, int window_size, ShardState &state) {
+  CHECK(syn_out_ != nullptr);
+  const int layer_size = kHiddenSize > 0 ? kHiddenSize : opt_.hidden_layer_size;
+  state.pairs.clear();
+  for (int s = begin; s < end; ++s) {
+    const vector<int> &sentence = batch.sentences[s];
+    const int sentence_len = sentence.size();
+    for (int i = 0; i < sentence_len; ++i) {
+      const int window = opt_.random_window
+          ? TokenWindow(window_size, &state.next_random) : window_size;
+      const int w_left = max(0, i - window);
+      const int w_right = min(sentence_len - 1, i + window);
+      for (int w = w_left; w <= w_right; ++w) {
+        if (w != i && sentence[w] < voc_->Size()) {
+          state.pairs.push_back(static_cast<uint64>(sentence[i]) << 32
+                                | static_cast<uint32>(sentence[w]));
+        }
+      }
+    }
+  }
+  sort(state.pairs.begin(), state.pairs.end());
+
+  real* in = &state.neu1[0];  // the input row being trained
+  real* neu1e = &state.neu1e[0];
+  state.in_delta.resize(layer_size);
+  real* delta = &state.in_delta[0];
+  const real alpha = state.alpha;
+  const size_t pair_num = state.pairs.size();
+  for (size_t p = 0; p < pair_num;) {
+    const int word_input = state.pairs[p] >> 32;
+    real* syn_in = syn_in_ + static_cast<size_t>(word_input) * layer_size;
+    memcpy(in, syn_in, layer_size * sizeof(real));
+    memset(delta, 0, layer_size * sizeof(real));
+    for (; p < pair_num && (state.pairs[p] >> 32) == word_input; ++p) {
+      const Word &target = (*voc_)[static_cast<uint32>(state.pairs[p])];
+      memset(neu1e, 0, layer_size * sizeof(real));
+      if (opt_.use_hierachical_softmax) {
+        for (int c_idx = 0; c_idx < target.code.size(); ++c_idx) {
+          real f = 0;
+          real* out = OutputRow(target.output_node_id[c_idx], layer_size,
+                                state.hot);
+          for (int h = 0; h < layer_size; ++h) {
+            f += in[h] * out[h];
+          }
 
+          f = Sigmoid(f);
+          real gradient = (1 - target.code[c_idx] - f);
+          for (int h = 0; h < layer_size; ++h) {
+            neu1e[h] += alpha * gradient * out[h];
+          }
+          for (int h = 0; h < layer_size; ++h) {
+            out[h] += alpha * gradient * in[h];
+          }
+        }
+      }
+      for (int h = 0; h < layer_size; ++h) {
+        in[h] += neu1e[h];
+        delta[h] += neu1e[h];
+      }
+    }
+    // add the update instead of storing the copy, other threads may have
+    // trained the same row meanwhile
+    for (int h = 0; h < layer_size; ++h) {
+      syn_in[h] += delta[h];
+    }
+    MarkDirty(word_input);
+  }
+}
+
+// The hot rows are the inner nodes right below the Huffman root. Inner node
+// n + k of the tree maps to output row k and the root is the last merged
+// node, so they are the rows just before Size() - 1.
+void WordVec::InitHotRows(HotRows &hot) const {
+  const int inner_end = voc_->Size() - 1;
+  hot.begin = max(0, inner_end - opt_.hot_output_rows);
+  hot.end = inner_end;
+  const size_t offset = static_cast<size_t>(hot.begin) * opt_.hidden_layer_size;
+  const size_t size = static_cast<size_t>(hot.end - hot.begin)
+      * opt_.hidden_layer_size;
+  hot.local.assign(syn_out_ + offset, syn_out_ + offset + size);
+  hot.base = hot.local;
+}
+
+// Add the updates made on the local replica since last merge to syn_out_,
+// and refresh the replica with the updates of other threads
+void WordVec::MergeHotRows(HotRows &hot) {
+  real* global = syn_out_ + static_cast<size_t>(hot.begin) * opt_.hidden_layer_size;
+#pragma omp critical (hot_rows)
+  {
+    for (size_t i = 0; i < hot.local.size(); ++i) {
+      global[i] += hot.local[i] - hot.base[i];
+      hot.local[i] = hot.base[i] = global[i];
+    }
+  }
+}
+
+bool WordVec::TrainModelWithFile(const WorkItem &item) {
+  return TrainShard(vector<WordVec*>(1, this), item);
+}
+
+// Every batch of sentences read from the shard is trained by all the models
+bool WordVec::TrainShard(const vector<WordVec*> &models, const WorkItem &item) {
+  WordVec* first = models[0];
+  // the reader thread tokenizes the next chunk while this one is trained
+  CorpusReader reader(*first->voc_, first->opt_.max_sentence_size,
+                      first->opt_.read_chunk_size, first->opt_.hash_buckets);
+  if (!reader.Open(item)) {
+    LOG(FATAL) << "No such training file: " << item.file << endl;
+    return false;
+  }
+
+  vector<ShardState> states(models.size());
+  for (size_t m = 0; m < models.size(); ++m) {
+    models[m]->BeginShard(states[m]);
+  }
+  const SentenceBatch* batch = nullptr;
+  while (reader.Next(batch)) {
+    for (size_t m = 0; m < models.size(); ++m) {
+      models[m]->TrainBatch(*batch, states[m]);
+    }
+  }
+  for (size_t m = 0; m < models.size(); ++m) {
+    models[m]->EndShard(states[m]);
+  }
+
+#pragma omp critical (io_time)
+  {
+    first->read_time_ += reader.GetReadTime();
+    first->read_wait_time_ += reader.GetWaitTime();
+  }
+  if (reader.Failed()) {
+    LOG(FATAL) << "fail to read " << item.file << " to the end of shard ["
+               << item.begin << ", " << item.end << ")" << endl;
+    return false;
+  }
+  return true;
+}
+
+void WordVec::BeginShard(ShardState &state) {
+  // continue the learning rate decay of the words trained so far, instead of
+  // restarting from start_alpha_ for every shard
+  const double train_word_total = voc_->GetTrainWordCount() * 1.0 * opt_.iter;
+  state.alpha = start_alpha_
+      * max(0.001, 1 - word_count_total_ / (train_word_total + 1));
+  state.word_count = state.last_word_count = 0;
+  // a different random window sequence for every thread and shard
+  state.next_random = omp_get_thread_num() * 0x9E3779B97F4A7C15ULL
+      + word_count_total_ + 1;
+  // Initialize neuron and neuron error, the sliding CBOW kernel keeps its
+  // context sum behind the hidden layer
+  state.neu1.assign(opt_.hidden_layer_size
+                    * (opt_.incremental_context > 0 ? 2 : 1), 0);
+  state.neu1e.assign(opt_.hidden_layer_size, 0);
+  // thread local replica of the output rows every prediction goes through
+  state.hot = nullptr;
+  if (opt_.hot_output_rows > 0 && opt_.use_hierachical_softmax) {
+    InitHotRows(state.hot_rows);
+    state.hot = &state.hot_rows;
+  }
+}
+
+void WordVec::TrainBatch(const SentenceBatch &batch, ShardState &state) {
+  const int window = opt_.windows_size;
+  uint64* next_random = opt_.random_window ? &state.next_random : nullptr;
   int train_word_total = voc_->GetTrainWordCount() * opt_.iter;
+  real* neu1 = &state.neu1[0];
+  real* neu1e = &state.neu1e[0];
 
-  while (!feof(fi)) {
-    if (word_count_curr_thread - last_word_count_curr_thread > 10000) {
+  for (int s = 0; s < batch.sentence_num;) {
+    if (state.word_count - state.last_word_count > 10000) {
 #pragma omp critical (word_count)
       {
-        word_count_total_ += word_count_curr_thread
-            - last_word_count_curr_thread;
+        word_count_total_ += state.word_count - state.last_word_count;
+      }
+      state.last_word_count = state.word_count;
+      if (state.hot != nullptr) {
+        MergeHotRows(*state.hot);
       }
-      last_word_count_curr_thread = word_count_curr_thread;
-      printf("Alpha: %f  Progress: %.2f%%\r", alpha,
+      printf("Alpha: %f  Progress: %.2f%%\r", state.alpha,
           word_count_total_ * 100.0 / (train_word_total + 1));
       fflush(stdout);
 
       // decay alpha according to training progress
-      alpha = start_alpha_
+      state.alpha = start_alpha_
           * max(0.001,
           (1 - word_count_total_ * 1.0 / train_word_total));
     }
 
-    sentence.clear();
-    if (sentence.empty()) {
-      // read enough words to consititude a sentence
-      while (sentence.size() < opt_.max_sentence_size && !feof(fi)) {
-        bool eol = ReadWord(word, fi);
-        int word_idx = voc_->GetWordIndex(word);
-        if (word_idx == -1) {
-          continue;
-        }
-        ++word_count_curr_thread;
-        sentence.push_back(word_idx);
-        // TODO: do subsampling to discards high-frequent words
-        // This is another trick of word2vec, but will not influence the final result
-        if (eol) {
-          break;
-        }
+    if (opt_.reorder_block_words > 0) {
+      // the block ends at the first sentence reaching reorder_block_words
+      int end = s;
+      int words = 0;
+      while (end < batch.sentence_num && words < opt_.reorder_block_words) {
+        words += batch.sentences[end++].size();
+      }
+      state.word_count += words;
+      if (opt_.model_type == kCBOW) {
+        (this->*cbow_block_kernel_)(batch, s, end, window, state);
+      } else if (opt_.model_type == kSkipGram) {
+        (this->*skipgram_block_kernel_)(batch, s, end, window, state);
       }
+      s = end;
+      continue;
     }
-    // finish read sentence
+
+    // TODO: do subsampling to discards high-frequent words
+    // This is another trick of word2vec, but will not influence the final result
+    const vector<int> &sentence = batch.sentences[s++];
+    state.word_count += sentence.size();
     if (opt_.model_type == kCBOW) {
-      TrainCBOWModel(sentence, neu1, neu1e, window, alpha);
+      (this->*cbow_kernel_)(sentence, neu1, neu1e, window, state.alpha,
+                            state.hot, next_random);
     } else if (opt_.model_type == kSkipGram) {
-      TrainSkipGramModel(sentence, neu1, window, alpha);
+      (this->*skipgram_kernel_)(sentence, neu1, window, state.alpha, state.hot,
+                                next_random);
     }
   }
+}
 
-  delete[] neu1;
-  delete[] neu1e;
+void WordVec::EndShard(ShardState &state) {
+  if (state.hot != nullptr) {
+    MergeHotRows(*state.hot);
+  }
 }
 
 //save the word vector(the input synapses) to file
-void WordVec::SaveVector(const string &output_file, bool binary_format = true) const {
-  // TODO: Check succeed to open file or not.
-  FILE* fo = fopen(output_file.c_str(), "wb");
+bool WordVec::SaveVector(const string &output_file, bool binary_format = true) const {
+  CHECK(voc_ != nullptr);
+  // the vocabulary is sorted by frequency, so pruning keeps the head rows
+  const int vocab_size = opt_.export_words > 0
+      ? min<int>(opt_.export_words, voc_->Size()) : voc_->Size();
+  const bool project = opt_.export_dim > 0
+      && opt_.export_dim < opt_.hidden_layer_size;
+  if (opt_.export_dim >= opt_.hidden_layer_size) {
+    LOG(WARNING) << "export_dim " << opt_.export_dim << " is not below "
+                 << "hidden_layer_size " << opt_.hidden_layer_size
+                 << ", the vectors are saved unprojected" << endl;
+  }
+  const real* buckets = syn_in_
+      + static_cast<size_t>(voc_->Size()) * opt_.hidden_layer_size;
+  const string bucket_file = output_file + kBucketFileSuffix;
+  if (mapped_in_ != nullptr && output_file == opt_.mapped_model_file) {
+    if (vocab_size < static_cast<int>(voc_->Size()) || project || opt_.export_normalize) {
+      LOG(ERROR) << "pruned or projected export needs another output than "
+                 << "the mapped model file" << endl;
+      return false;
+    }
+    // the vectors are already in the file, only the words are missing
+    if (!FinishMappedModel()) {
+      return false;
+    }
+    if (opt_.hash_buckets == 0) {
+      remove(bucket_file.c_str());
+      return true;
+    }
+    return WriteRows(bucket_file, buckets, voc_->Size(), opt_.hash_buckets,
+                     opt_.hidden_layer_size, true);
+  }
+
+  unique_ptr<PcaProjection> pca;
+  if (project) {
+    pca.reset(PcaProjection::Fit(syn_in_, vocab_size,
+        opt_.hidden_layer_size, opt_.export_dim));
+    CHECK(pca != nullptr);
+    LOG(INFO) << "Projected " << vocab_size << " vectors to "
+              << opt_.export_dim << " dimensions, explained variance "
+              << pca->GetExplainedVariance() << endl;
+  }
+  const int dim = project ? opt_.export_dim : opt_.hidden_layer_size;
+  vector<real> exported;
+  if (!WriteRows(output_file, ExportRows(syn_in_, vocab_size, pca.get(),
+                                         exported),
+                 0, vocab_size, dim, binary_format)) {
+    return false;
+  }
+  // Words pruned from the export had rows of their own, a lookup would give
+  // them an unrelated bucket, so a pruned export has no buckets. The bucket
+  // file of an earlier run is removed, WordVecModel::Load would pick it up.
+  if (opt_.hash_buckets == 0 || vocab_size < voc_->Size()) {
+    if (opt_.hash_buckets > 0) {
+      LOG(WARNING) << "hash buckets are not saved for a pruned vocabulary"
+                   << endl;
+    }
+    remove(bucket_file.c_str());
+    return true;
+  }
+  // the buckets are exported like the words, so their vectors can be
+  // compared with the ones of the model
+  return WriteRows(bucket_file, ExportRows(buckets, opt_.hash_buckets,
+                                           pca.get(), exported),
+                   voc_->Size(), opt_.hash_buckets, dim, binary_format);
+}
+
+const real* WordVec::ExportRows(const real* rows, int row_num,
+                                const PcaProjection* pca,
+                                vector<real> &exported) const {
+  if (pca == nullptr && !opt_.export_normalize) {
+    return rows;
+  }
+  int dim = opt_.hidden_layer_size;
+  if (pca != nullptr) {
+    dim = opt_.export_dim;
+    exported.resize(static_cast<size_t>(row_num) * dim);
+    pca->Project(rows, row_num, &exported[0]);
+  } else {
+    exported.assign(rows, rows + static_cast<size_t>(row_num) * dim);
+  }
+  if (opt_.export_normalize) {
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < row_num; ++i) {
+      NormalizeRow(&exported[static_cast<size_t>(i) * dim], dim);
+    }
+  }
+
+  return &exported[0];
+}
+
+bool WordVec::WriteRows(const string &file, const real* matrix,
+                        int first_row, int row_num, int dim,
+                        bool binary_format) const {
+  FILE* fo = fopen(file.c_str(), "wb");
+  if (fo == nullptr) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return false;
+  }
   FileCloser fcloser(fo);
-  fprintf(fo, "%lld %lld\n", (long long) voc_->Size(),
-      (long long) opt_.hidden_layer_size);
-  for (int i = 0; i < voc_->Size(); ++i) {
-    fprintf(fo, "%s ", (*voc_)[i].word.c_str());
-    for (int j = 0; j < opt_.hidden_layer_size; ++j) {
+  fprintf(fo, "%lld %lld\n", (long long) row_num, (long long) dim);
+
+  // rows are formatted block by block in parallel into per-thread buffers,
+  // and the buffers are written out in block order
+  const int block_num = (row_num + kSaveBlockRows - 1) / kSaveBlockRows;
+  vector<string> buffers(omp_get_max_threads());
+  bool succeed = true;
+#pragma omp parallel for ordered schedule(static, 1)
+  for (int b = 0; b < block_num; ++b) {
+    string &buf = buffers[omp_get_thread_num()];
+    buf.clear();
+    const int row_end = min(row_num, (b + 1) * kSaveBlockRows);
+    for (int i = b * kSaveBlockRows; i < row_end; ++i) {
+      const real* row = matrix + static_cast<size_t>(i) * dim;
+      buf.append(RowName(first_row + i));
+      buf.push_back(' ');
       if (binary_format) {
-        fwrite(&syn_in_[i * opt_.hidden_layer_size + j], sizeof(real), 1, fo);
+        buf.append(reinterpret_cast<const char*>(row), dim * sizeof(real));
       } else {
-        fprintf(fo, "%lf ", syn_in_[i * opt_.hidden_layer_size + j]);
+        for (int j = 0; j < dim; ++j) {
+          AppendReal(buf, row[j]);
+          buf.push_back(' ');
+        }
       }
+      buf.push_back('\n');
     }
-    fprintf(fo, "\n");
+#pragma omp ordered
+    {
+      if (succeed && fwrite(buf.data(), 1, buf.size(), fo) != buf.size()) {
+        succeed = false;
+      }
+    }
+  }
+
+  if (!succeed || fflush(fo) != 0 || ferror(fo)) {
+    LOG(ERROR) << "fail to write word vector to " << file << endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool WordVec::FinishMappedModel() const {
+  CHECK(mapped_in_ != nullptr);
+  const size_t rows = voc_->Size();
+  MappedModelHeader header;
+  memcpy(header.magic, kMappedModelMagic, sizeof(header.magic));
+  header.rows = rows;
+  header.dim = opt_.hidden_layer_size;
+  header.matrix_offset = kMappedHeaderSize;
+  // the hash bucket rows stay between the vectors and the words
+  header.words_offset = kMappedHeaderSize
+      + (rows + opt_.hash_buckets) * opt_.hidden_layer_size * sizeof(real);
+  memcpy(mapped_in_->Base(), &header, sizeof(header));
+  if (!mapped_in_->Sync()) {
+    LOG(ERROR) << "fail to sync " << opt_.mapped_model_file << endl;
+    return false;
+  }
+
+  string words;
+  for (size_t i = 0; i < rows; ++i) {
+    words.append((*voc_)[i].word);
+    words.push_back('\n');
+  }
+  const int fd = mapped_in_->GetFd();
+  size_t written = 0;
+  while (written < words.size()) {
+    ssize_t n = pwrite(fd, words.data() + written, words.size() - written,
+                       header.words_offset + written);
+    if (n <= 0) {
+      LOG(ERROR) << "fail to write words to " << opt_.mapped_model_file << endl;
+      return false;
+    }
+    written += n;
+  }
+  if (fsync(fd) != 0) {
+    LOG(ERROR) << "fail to sync " << opt_.mapped_model_file << endl;
+    return false;
+  }
+  return true;
+}
+
+bool WordVec::SaveDelta(const string &delta_file) const {
+  CHECK(voc_ != nullptr);
+  // the rows are the raw input rows, they only fit a full model
+  if (opt_.export_words > 0 || opt_.export_normalize
+      || (opt_.export_dim > 0 && opt_.export_dim < opt_.hidden_layer_size)) {
+    LOG(ERROR) << "a delta does not match a pruned, projected or normalized "
+               << "export" << endl;
+    return false;
+  }
+  if (dirty_rows_.empty()) {
+    LOG(ERROR) << "a delta needs the rows changed since an initial model"
+               << endl;
+    return false;
+  }
+  const string bucket_file = delta_file + kBucketFileSuffix;
+  if (opt_.hash_buckets == 0) {
+    remove(bucket_file.c_str());
+    return WriteDelta(delta_file, 0, voc_->Size());
+  }
+  // the buckets of the deployed model have to follow its words
+  return WriteDelta(delta_file, 0, voc_->Size())
+      && WriteDelta(bucket_file, voc_->Size(),
+                    voc_->Size() + opt_.hash_buckets);
+}
+
+bool WordVec::WriteDelta(const string &file, size_t row_begin,
+                         size_t row_end) const {
+  vector<size_t> rows;
+  for (size_t i = row_begin; i < row_end; ++i) {
+    const bool dirty = (dirty_rows_[i >> 6] >> (i & 63)) & 1;
+    if (dirty || !in_init_model_[i]) {
+      rows.push_back(i);
+    }
+  }
+
+  FILE* fo = fopen(file.c_str(), "wb");
+  if (fo == nullptr) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return false;
+  }
+  FileCloser fcloser(fo);
+  fprintf(fo, "%s %d %zu\n", kModelDeltaMagic, opt_.hidden_layer_size,
+          rows.size());
+  for (const size_t i : rows) {
+    fprintf(fo, "%s ", RowName(i).c_str());
+    fwrite(syn_in_ + i * opt_.hidden_layer_size, sizeof(real),
+           opt_.hidden_layer_size, fo);
+    fputc('\n', fo);
+  }
+  if (fflush(fo) != 0 || ferror(fo)) {
+    LOG(ERROR) << "fail to write delta to " << file << endl;
+    return false;
   }
+  LOG(INFO) << "Saved " << rows.size() << " of " << row_end - row_begin
+            << " rows to " << file << endl;
+  return true;
 }
@@ -11,10 +11,48 @@
 #include <cstdio>
 #include <memory>
 
+#include "corpus_reader.h"
+#include "mapped_table.h"
 #include "options.h"
+#include "scheduler.h"
 #include "utils.h"
 #include "vocabulary.h"
 
+class PcaProjection;
+
+// Thread local copy of the output rows near the Huffman root, which every
+// hierarchical softmax prediction updates. Threads train on their copy and
+// merge the deltas back periodically instead of fighting over cache lines.
+struct HotRows {
+  int begin;  // replicated output rows are [begin, end)
+  int end;
+  std::vector<real> local;  // the rows updated by this thread
+  std::vector<real> base;   // the global rows at the last merge
+
+  HotRows() : begin(0), end(0) {
+  }
+};
+
+// Per-thread state of one model while it trains a shard
+struct ShardState {
+  std::vector<real> neu1;   // hidden layer
+  std::vector<real> neu1e;  // error of hidden layer
+  HotRows hot_rows;
+  HotRows* hot;             // &hot_rows when hot rows are replicated
+  std::vector<uint64> pairs;    // training pairs of a reordered block
+  std::vector<int> starts;      // first pair position of each block sentence
+  std::vector<real> in_delta;   // update of the input row trained in cache
+  uint64 next_random;           // state of the random window generator
+  real alpha;
+  int word_count;
+  int last_word_count;      // word_count when progress was last reported
+
+  ShardState()
+      : hot(nullptr), next_random(1), alpha(0), word_count(0),
+        last_word_count(0) {
+  }
+};
+
 class WordVec {
  public:
   WordVec();
@@ -23,35 +61,219 @@ class WordVec {
 
   virtual ~WordVec();
 
-  void Train(const std::vector<std::string> &files);
+  // Return false if the vocabulary or a training file could not be read,
+  // the model is then only partly trained
+  bool Train(const std::vector<std::string> &files);
 
-  void TrainModelWithFile(const std::string &file_name);
+  // Train several models with one pass over the corpus. They share the
+  // vocabulary, the Huffman codes and the tokenized sentences, so reading
+  // and tokenizing are paid once. Vocabulary, sharding, reading and iter
+  // options are taken from the first model. Return false as Train does.
+  static bool TrainModels(const std::vector<WordVec*> &models,
+                          const std::vector<std::string> &files);
 
-  //save the word vector(the input synapses) to file
-  void SaveVector(const std::string &output_file, bool binary_format) const;
+  // Train with the words of one shard of a training file, return false if
+  // it could not be read to its end
+  bool TrainModelWithFile(const WorkItem &item);
+
+  //save the word vector(the input synapses) to file, return false on I/O error
+  // Saving to the mapped model file finishes it in place instead. With
+  // -hash_buckets the bucket rows go to output_file + kBucketFileSuffix.
+  bool SaveVector(const std::string &output_file, bool binary_format) const;
+
+  // Save the rows changed by training and the words not in the model of
+  // opt_.init_model_file as a delta for ApplyModelDelta, see model_delta.h.
+  // With -hash_buckets the bucket rows go to delta_file + kBucketFileSuffix.
+  bool SaveDelta(const std::string &delta_file) const;
+
+  // wall time in seconds spent by the last Train call, without vocabulary
+  double GetTrainTime() const {
+    return train_time_;
+  }
+
+  // words trained by the last Train call over all iterations
+  long long GetTrainWordCount() const {
+    return voc_ == nullptr ? 0 : voc_->GetTrainWordCount() * 1LL * opt_.iter;
+  }
 
  private:
   void InitializeNetwork();
+
+  void SelectKernels();
+
+  // copy the vectors of opt_.init_model_file, and of its hash buckets if
+  // saved, into the input layer
+  bool LoadInitModel();
+
+  // copy the rows of a binary model into the input rows of their words, or
+  // of their buckets, and mark them in in_init_model_. row_num is the row
+  // number of the file and known the rows copied.
+  bool LoadInitRows(const std::string &file, bool buckets, long long &row_num,
+                    long long &known);
+
+  // word or bucket name of an input row in saved models
+  std::string RowName(size_t row) const;
+
+  // save the rows of [row_begin, row_end) changed since the initial model
+  bool WriteDelta(const std::string &file, size_t row_begin,
+                  size_t row_end) const;
+
+  // remember that training changed the input row, if rows are tracked
+  void MarkDirty(int row) {
+    if (!dirty_rows_.empty()) {
+      uint64 &bits = dirty_rows_[row >> 6];
+      const uint64 mask = 1ULL << (row & 63);
+      // most rows are already marked, skip the atomic write for them
+      if ((bits & mask) == 0) {
+#pragma omp atomic
+        bits |= mask;
+      }
+    }
+  }
+
+  // map the tables to files as configured by opt_.mapped_model_file
+  bool MapNetwork();
+
+  // write the header and the words behind the mapped input layer
+  bool FinishMappedModel() const;
+
+  // Project and normalize row_num input rows as configured for export,
+  // return the rows to save: rows itself when the export keeps them as is,
+  // else exported
+  const real* ExportRows(const real* rows, int row_num,
+                         const PcaProjection* pca,
+                         std::vector<real> &exported) const;
+
+  // write row_num rows of dim values in the model format, row i is named
+  // after the input row first_row + i
+  bool WriteRows(const std::string &file, const real* matrix, int first_row,
+                 int row_num, int dim, bool binary_format) const;
+
+  // report how much of the mapped tables stays resident after training
+  void ReportResidency() const;
+
+  static bool TrainShard(const std::vector<WordVec*> &models,
+                         const WorkItem &item);
+
+  void BeginShard(ShardState &state);
+
+  void TrainBatch(const SentenceBatch &batch, ShardState &state);
+
+  void EndShard(ShardState &state);
+
+  void InitHotRows(HotRows &hot) const;
+
+  void MergeHotRows(HotRows &hot);
+
+  // The row of output layer to train, the thread local replica if it is hot
+  real* OutputRow(int row, int layer_size, HotRows* hot) {
+    if (hot != nullptr && row >= hot->begin && row < hot->end) {
+      return &hot->local[static_cast<size_t>(row - hot->begin) * layer_size];
+    }
+    return syn_out_ + static_cast<size_t>(row) * layer_size;
+  }
+
   // Training Continous Bag-of-Words model with one sentence, alpha is the learning rate
+  // kHiddenSize is the hidden layer size known at compile time, 0 means
+  // reading it from options at runtime
+  // hot is the thread local replica of hot output rows, nullptr if disabled
+  // next_random draws a reduced window for every token, nullptr keeps the
+  // full window_size
+  template <int kHiddenSize>
   void TrainCBOWModel(const std::vector<int> &sentence, real neu1[],
-                      real neu1e[], int window_size, real alpha);
+                      real neu1e[], int window_size, real alpha, HotRows* hot,
+                      uint64* next_random);
+
+  // Train the CBOW prediction of the word at w_target_idx of sentence
+  template <int kHiddenSize>
+  void TrainCBOWWord(const std::vector<int> &sentence, int w_target_idx,
+                     real neu1[], real neu1e[], int window_size, real alpha,
+                     HotRows* hot);
+
+  // Train the target from the hidden layer and the context [w_left, w_right]
+  template <int kHiddenSize>
+  void TrainCBOWOutput(const std::vector<int> &sentence, int w_target_idx,
+                       int w_left, int w_right, const real neu1[],
+                       real neu1e[], real alpha, HotRows* hot);
+
+  // CBOW with a running sum of the context rows instead of summing the
+  // whole window for every target, neu1 holds 2 * layer size reals
+  template <int kHiddenSize>
+  void TrainCBOWSliding(const std::vector<int> &sentence, real neu1[],
+                        real neu1e[], int window_size, real alpha,
+                        HotRows* hot, uint64* next_random);
+
+  // sum += weight * the input row of word
+  template <int kHiddenSize>
+  void AddRow(real sum[], int word, real weight) const;
 
   // Training Skip-Gram model with one sentence, alpha is the learning rate
+  template <int kHiddenSize>
   void TrainSkipGramModel(const std::vector<int> &sentence, real neu1e[],
-                          int window_size, real alpha);
+                          int window_size, real alpha, HotRows* hot,
+                          uint64* next_random);
+
+  // Train sentences [begin, end) of batch with the predictions sorted by
+  // target word, so the same Huffman paths are walked back to back
+  template <int kHiddenSize>
+  void TrainCBOWBlock(const SentenceBatch &batch, int begin, int end,
+                      int window_size, ShardState &state);
+
+  // Train sentences [begin, end) of batch with the (input, target) pairs
+  // sorted, every input row is loaded once per block and trained in cache
+  template <int kHiddenSize>
+  void TrainSkipGramBlock(const SentenceBatch &batch, int begin, int end,
+                          int window_size, ShardState &state);
+
+  typedef void (WordVec::*CBOWKernel)(const std::vector<int>&, real[], real[],
+                                      int, real, HotRows*, uint64*);
+
+  typedef void (WordVec::*SkipGramKernel)(const std::vector<int>&, real[],
+                                          int, real, HotRows*, uint64*);
+
+  typedef void (WordVec::*BlockKernel)(const SentenceBatch&, int, int, int,
+                                       ShardState&);
 
   WordVec(const WordVec&);  // no copying!
 
   void operator=(const WordVec&);  // no copying!
 
-  std::unique_ptr<Vocabulary> voc_;
+  // shared by all the models trained together
+  std::shared_ptr<Vocabulary> voc_;
 
   real* syn_in_;  //synapses for input layer
 
   real* syn_out_;  //synapses for output layer
 
+  // file mappings behind syn_in_ and syn_out_ when they are out of core
+  std::unique_ptr<MappedTable> mapped_in_;
+
+  std::unique_ptr<MappedTable> mapped_out_;
+
+  // bitset of the input rows changed by training, empty if not tracked
+  std::vector<uint64> dirty_rows_;
+
+  // whether the word of a row came from opt_.init_model_file
+  std::vector<bool> in_init_model_;
+
   size_t word_count_total_;
 
+  double train_time_;
+
+  // seconds spent by reader threads, and by trainers waiting for them
+  double read_time_;
+
+  double read_wait_time_;
+
+  // training kernels dispatched once according to hidden layer size
+  CBOWKernel cbow_kernel_;
+
+  SkipGramKernel skipgram_kernel_;
+
+  BlockKernel cbow_block_kernel_;
+
+  BlockKernel skipgram_block_kernel_;
+
   Options opt_;
 };
 
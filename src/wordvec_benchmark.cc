@@ -0,0 +1,376 @@
+/*
+ * wordvec_benchmark.cc
+ *
+ * Throughput benchmark for the training kernels on a synthetic corpus
+ * whose word frequencies follow Zipf's law, either comparing kernels or
+ * measuring thread scaling, the cache locality of the training order or
+ * the random window. The words of every sentence come from one topic, so
+ * the nearest neighbours of a well trained word share its topic.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <memory>
+#include <omp.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "options.h"
+#include "utils.h"
+#include "wordvec.h"
+#include "wordvec_model.h"
+
+using namespace std;
+
+DEFINE_string(bench_dir, "/tmp", "folder to write the synthetic corpus");
+DEFINE_int32(bench_files, 4, "number of synthetic corpus files");
+DEFINE_int32(bench_words, 1000000, "number of words in synthetic corpus");
+DEFINE_int32(bench_vocab, 30000, "number of distinct words in synthetic corpus");
+DEFINE_int32(bench_topics, 16, "number of topics sentences of the synthetic corpus are drawn from");
+DEFINE_int32(threads, 4, "multi-thread number");
+DEFINE_int32(window, 5, "sliding window size");
+DEFINE_int32(iter, 1, "iteration for training the corpus");
+DEFINE_string(bench_mode, "kernels",
+              "kernels: generic vs specialized kernels; "
+              "scaling: throughput from 1 to -threads threads; "
+              "locality: sentence order vs reordered blocks with cache misses; "
+              "window: full vs random windows and sliding CBOW context, with topic accuracy");
+DEFINE_int32(hidden_size, 100, "hidden layer size in scaling mode");
+DEFINE_int32(hot_output_rows, 64, "hot output rows replicated in scaling mode");
+DEFINE_int32(reorder_block, 10000, "words per reordered block in locality mode");
+DEFINE_int32(incremental_context, 64, "exact recompute interval of the sliding CBOW context in window mode");
+
+namespace {
+const int kHiddenSizes[] = {50, 100, 128, 200, 256, 300};
+
+const int kSentenceWords = 20;
+
+// most frequent words whose nearest neighbour is checked for the accuracy
+const int kAccuracyWords = 1000;
+
+// Word w belongs to topic w % bench_topics
+inline int Topic(int word) {
+  return word % FLAGS_bench_topics;
+}
+
+// Write a corpus of sentences with Zipf distributed words, all the words of
+// a sentence are from the same topic. The same seed always generates the
+// same corpus.
+vector<string> GenerateCorpus() {
+  vector<double> cdf(FLAGS_bench_vocab);
+  double sum = 0;
+  for (int i = 0; i < FLAGS_bench_vocab; ++i) {
+    sum += 1.0 / (i + 1);
+    cdf[i] = sum;
+  }
+
+  srand(1);
+  vector<string> files;
+  const int words_per_file = FLAGS_bench_words / FLAGS_bench_files;
+  for (int f = 0; f < FLAGS_bench_files; ++f) {
+    const string file = FLAGS_bench_dir + "/wordvec_bench_" + to_string(f);
+    FILE *fo = fopen(file.c_str(), "w");
+    if (fo == nullptr) {
+      LOG(FATAL) << "fail to open " << file << endl;
+      return files;
+    }
+    FileCloser fcloser(fo);
+    int topic = 0;
+    for (int w = 0; w < words_per_file; ++w) {
+      if (w % kSentenceWords == 0) {
+        topic = RandInt(FLAGS_bench_topics);
+      }
+      const double r = RandReal() * sum;
+      int idx = lower_bound(cdf.begin(), cdf.end(), r) - cdf.begin();
+      // the word of the topic closest in frequency
+      idx = idx - Topic(idx) + topic;
+      while (idx >= FLAGS_bench_vocab) {
+        idx -= FLAGS_bench_topics;
+      }
+      fprintf(fo, "w%d%c", idx, (w + 1) % kSentenceWords == 0 ? '\n' : ' ');
+    }
+    files.push_back(file);
+  }
+
+  return files;
+}
+
+// Hardware cache misses of the OpenMP threads, read with perf_event_open.
+// Every thread counts itself, so the training threads must be the ones of
+// the OpenMP team that called Start.
+class CacheMissCounter {
+ public:
+  CacheMissCounter() : fds_(omp_get_max_threads(), -1) {
+  }
+
+  ~CacheMissCounter() {
+    Close();
+  }
+
+  // return false if counters are not available, e.g. perf_event_paranoid
+  bool Start() {
+    Close();
+    bool succeed = true;
+#pragma omp parallel
+    {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      fds_[omp_get_thread_num()] = fd;
+      if (fd < 0) {
+#pragma omp atomic write
+        succeed = false;
+      }
+    }
+    return succeed;
+  }
+
+  // misses counted by all threads since Start, -1 if unavailable
+  long long Stop() {
+    long long total = 0;
+    for (const int fd : fds_) {
+      long long count = 0;
+      if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+        total = -1;
+        break;
+      }
+      total += count;
+    }
+    Close();
+    return total;
+  }
+
+ private:
+  void Close() {
+    for (int &fd : fds_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      fd = -1;
+    }
+  }
+
+  vector<int> fds_;
+};
+
+// Share of the most frequent words whose nearest neighbour is from the
+// same topic, -1 on failure
+double TopicAccuracy(const WordVec &wordvec) {
+  const string file = FLAGS_bench_dir + "/wordvec_bench.vec";
+  if (!wordvec.SaveVector(file, true)) {
+    return -1;
+  }
+  unique_ptr<WordVecModel> model(WordVecModel::Load(file));
+  remove(file.c_str());
+  if (model == nullptr) {
+    return -1;
+  }
+  const int word_num = min<int>(kAccuracyWords, model->Size());
+  int correct = 0;
+  vector<Neighbor> result;
+  for (int i = 0; i < word_num; ++i) {
+    const string &word = model->GetWord(i);
+    if (model->MostSimilar(word, 1, result) && !result.empty()) {
+      const int neighbour = atoi(model->GetWord(result[0].index).c_str() + 1);
+      correct += Topic(neighbour) == Topic(atoi(word.c_str() + 1));
+    }
+  }
+  return correct * 1.0 / word_num;
+}
+
+// Return the training throughput in words per second, and the topic
+// accuracy of the vectors if accuracy is given
+double Run(const vector<string> &files, const Options &options,
+           double* accuracy = nullptr) {
+  WordVec wordvec(options);
+  CHECK(wordvec.Train(files));
+  if (accuracy != nullptr) {
+    *accuracy = TopicAccuracy(wordvec);
+  }
+  return FLAGS_bench_words * 1.0 * options.iter / wordvec.GetTrainTime();
+}
+
+// Compare generic and specialized kernels for every specialized size
+void BenchKernels(const vector<string> &files, Options options) {
+  vector<string> report;
+  for (const ModelType model : {kCBOW, kSkipGram}) {
+    options.model_type = model;
+    for (const int hidden_size : kHiddenSizes) {
+      options.hidden_layer_size = hidden_size;
+      options.use_specialized_kernel = false;
+      const double generic = Run(files, options);
+      options.use_specialized_kernel = true;
+      const double specialized = Run(files, options);
+
+      char line[256];
+      snprintf(line, sizeof(line), "%-9s %6d %14.1f %14.1f %8.2fx",
+               model == kCBOW ? "cbow" : "skipgram", hidden_size,
+               generic / 1000, specialized / 1000, specialized / generic);
+      report.push_back(line);
+    }
+  }
+
+  printf("\n%-9s %6s %14s %14s %9s\n", "model", "hidden", "generic(kw/s)",
+         "special(kw/s)", "speedup");
+  for (const auto &line : report) {
+    printf("%s\n", line.c_str());
+  }
+}
+
+// Words per second from 1 thread up to -threads, with and without the hot
+// output row replicas. Efficiency is the speedup over one thread divided by
+// the number of threads.
+void BenchScaling(const vector<string> &files, Options options) {
+  options.hidden_layer_size = FLAGS_hidden_size;
+  vector<string> report;
+  // powers of two, always ending with -threads
+  vector<int> thread_nums;
+  for (int threads = 1; threads < FLAGS_threads; threads *= 2) {
+    thread_nums.push_back(threads);
+  }
+  thread_nums.push_back(FLAGS_threads);
+
+  double base[2] = {0, 0};
+  for (const int threads : thread_nums) {
+    omp_set_num_threads(threads);
+    options.thread_num = threads;
+    for (int replicated = 0; replicated < 2; ++replicated) {
+      options.hot_output_rows = replicated ? FLAGS_hot_output_rows : 0;
+      const double speed = Run(files, options);
+      if (threads == 1) {
+        base[replicated] = speed;
+      }
+      char line[256];
+      snprintf(line, sizeof(line), "%7d %8d %14.1f %14.1f %10.1f%%", threads,
+               options.hot_output_rows, speed / 1000, speed / threads / 1000,
+               speed / base[replicated] / threads * 100);
+      report.push_back(line);
+    }
+  }
+  omp_set_num_threads(FLAGS_threads);
+
+  printf("\n%7s %8s %14s %14s %11s\n", "threads", "hot_rows", "total(kw/s)",
+         "thread(kw/s)", "efficiency");
+  for (const auto &line : report) {
+    printf("%s\n", line.c_str());
+  }
+}
+
+// Words per second and cache misses per word, training in sentence order
+// and in blocks reordered by row
+void BenchLocality(const vector<string> &files, Options options) {
+  options.hidden_layer_size = FLAGS_hidden_size;
+  vector<string> report;
+  CacheMissCounter counter;
+  for (const ModelType model : {kCBOW, kSkipGram}) {
+    options.model_type = model;
+    for (const int block : {0, FLAGS_reorder_block}) {
+      options.reorder_block_words = block;
+      const bool counting = counter.Start();
+      const double speed = Run(files, options);
+      const long long misses = counting ? counter.Stop() : -1;
+
+      char line[256];
+      if (misses >= 0) {
+        snprintf(line, sizeof(line), "%-9s %8d %14.1f %16.2f",
+                 model == kCBOW ? "cbow" : "skipgram", block, speed / 1000,
+                 misses * 1.0 / FLAGS_bench_words / options.iter);
+      } else {
+        snprintf(line, sizeof(line), "%-9s %8d %14.1f %16s",
+                 model == kCBOW ? "cbow" : "skipgram", block, speed / 1000,
+                 "n/a");
+      }
+      report.push_back(line);
+    }
+  }
+
+  printf("\n%-9s %8s %14s %16s\n", "model", "block", "total(kw/s)",
+         "cache miss/word");
+  for (const auto &line : report) {
+    printf("%s\n", line.c_str());
+  }
+}
+
+// Words per second and topic accuracy with the full window for every word
+// and with windows drawn from [1, -window], CBOW also with the sliding sum
+// of the context
+void BenchWindow(const vector<string> &files, Options options) {
+  options.hidden_layer_size = FLAGS_hidden_size;
+  vector<string> report;
+  for (const ModelType model : {kCBOW, kSkipGram}) {
+    options.model_type = model;
+    for (const int incremental : {0, FLAGS_incremental_context}) {
+      if (incremental > 0 && model != kCBOW) {
+        continue;
+      }
+      options.incremental_context = incremental;
+      for (const bool random : {false, true}) {
+        options.random_window = random;
+        double accuracy = 0;
+        const double speed = Run(files, options, &accuracy);
+
+        char line[256];
+        snprintf(line, sizeof(line), "%-9s %6d %7s %8s %14.1f %13.1f%%",
+                 model == kCBOW ? "cbow" : "skipgram", options.windows_size,
+                 random ? "random" : "full",
+                 incremental > 0 ? "sliding" : "summed", speed / 1000,
+                 accuracy * 100);
+        report.push_back(line);
+      }
+    }
+  }
+
+  printf("\n%-9s %6s %7s %8s %14s %14s\n", "model", "window", "mode",
+         "context", "total(kw/s)", "topic acc");
+  for (const auto &line : report) {
+    printf("%s\n", line.c_str());
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  ::gflags::ParseCommandLineFlags(&argc, &argv, true);
+  omp_set_num_threads(FLAGS_threads);
+
+  const vector<string> files = GenerateCorpus();
+  const string vocab_file = FLAGS_bench_dir + "/wordvec_bench.vocab";
+
+  Options options;
+  options.thread_num = FLAGS_threads;
+  options.windows_size = FLAGS_window;
+  options.iter = FLAGS_iter;
+  options.save_vocab_file = vocab_file;
+  // count the vocabulary once, all the following runs reuse it
+  Run(files, options);
+  options.save_vocab_file.clear();
+  options.read_vocab_file = vocab_file;
+
+  if (FLAGS_bench_mode == "scaling") {
+    BenchScaling(files, options);
+  } else if (FLAGS_bench_mode == "locality") {
+    BenchLocality(files, options);
+  } else if (FLAGS_bench_mode == "window") {
+    BenchWindow(files, options);
+  } else {
+    BenchKernels(files, options);
+  }
+
+  for (const auto &f : files) {
+    remove(f.c_str());
+  }
+  remove(vocab_file.c_str());
+
+  return 0;
+}
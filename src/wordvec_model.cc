@@ -0,0 +1,402 @@
+/*
+ * wordvec_model.cc
+ */
+
+#include "wordvec_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mapped_table.h"
+
+using namespace std;
+
+namespace {
+// rows of the matrix scored together in NearestBatch, 512 rows of 300
+// floats stay well inside L2 cache
+const int kRowBlock = 512;
+
+// queries scored against one row block in NearestBatch
+const int kQueryBlock = 32;
+
+inline real Dot(const real* a, const real* b, int n) {
+  real sum = 0;
+#pragma omp simd reduction(+:sum)
+  for (int i = 0; i < n; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+// longest number token of a model, "%lf" of a float needs at most 47
+const int kMaxNumberSize = 64;
+
+inline bool IsSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Copy the next token before end into buf and advance p past it. The model
+// is mapped without a terminating NUL, so strtol and strtof must not run on
+// it directly. Return false if there is no token or it is too long.
+bool NextNumber(const char* &p, const char* end, char (&buf)[kMaxNumberSize]) {
+  while (p < end && IsSpace(*p)) {
+    ++p;
+  }
+  const char* begin = p;
+  while (p < end && !IsSpace(*p)) {
+    ++p;
+  }
+  if (p == begin || p - begin >= kMaxNumberSize) {
+    return false;
+  }
+  memcpy(buf, begin, p - begin);
+  buf[p - begin] = '\0';
+  return true;
+}
+
+void Normalize(real* vec, int n) {
+  const real len = sqrt(Dot(vec, vec, n));
+  if (len > 0) {
+    for (int i = 0; i < n; ++i) {
+      vec[i] /= len;
+    }
+  }
+}
+
+// Keep the k best neighbours in a min-heap whose top is the worst kept one
+inline void PushNeighbor(vector<Neighbor> &heap, int k, int index, real score) {
+  if (heap.size() < k) {
+    heap.emplace_back(index, score);
+    push_heap(heap.begin(), heap.end());
+  } else if (score > heap.front().score) {
+    pop_heap(heap.begin(), heap.end());
+    heap.back() = Neighbor(index, score);
+    push_heap(heap.begin(), heap.end());
+  }
+}
+
+inline bool Excluded(const vector<int> &exclude, int index) {
+  return find(exclude.begin(), exclude.end(), index) != exclude.end();
+}
+
+} // namespace
+
+WordVecModel::WordVecModel() : dim_(0) {
+}
+
+WordVecModel::~WordVecModel() = default;
+
+WordVecModel* WordVecModel::Load(const string &file, bool binary_format) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "fail to open " << file << endl;
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    LOG(ERROR) << "fail to stat " << file << endl;
+    close(fd);
+    return nullptr;
+  }
+  // map the file once and parse it in place
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "fail to mmap " << file << endl;
+    return nullptr;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  unique_ptr<WordVecModel> model(new WordVecModel());
+  const char* content = static_cast<const char*>(data);
+  bool succeed;
+  const bool mapped = st.st_size >= sizeof(MappedModelHeader) &&
+      memcmp(content, kMappedModelMagic, sizeof(kMappedModelMagic)) == 0;
+  if (mapped) {
+    succeed = model->ParseMapped(content, st.st_size);
+  } else {
+    succeed = model->Parse(content, st.st_size, binary_format);
+  }
+  munmap(data, st.st_size);
+  if (!succeed) {
+    LOG(ERROR) << "fail to parse model " << file << endl;
+    return nullptr;
+  }
+  // the buckets of a mapped model are always saved in binary format
+  const string bucket_file = file + kBucketFileSuffix;
+  if (access(bucket_file.c_str(), F_OK) == 0
+      && !model->LoadBuckets(bucket_file, mapped || binary_format)) {
+    return nullptr;
+  }
+
+  return model.release();
+}
+
+bool WordVecModel::LoadBuckets(const string &file, bool binary_format) {
+  unique_ptr<WordVecModel> buckets(Load(file, binary_format));
+  if (buckets == nullptr) {
+    return false;
+  }
+  if (buckets->Dimension() != dim_) {
+    LOG(ERROR) << "buckets of " << file << " have " << buckets->Dimension()
+               << " dimensions instead of " << dim_ << endl;
+    return false;
+  }
+  // the rows are in bucket order, their names are not needed
+  buckets_.swap(buckets->matrix_);
+
+  return true;
+}
+
+bool WordVecModel::Parse(const char* data, size_t size, bool binary_format) {
+  const char* p = data;
+  const char* end = data + size;
+  auto skip_space = [&p, end]() {
+    while (p < end && IsSpace(*p)) {
+      ++p;
+    }
+  };
+
+  // header: word number and dimension
+  char number[kMaxNumberSize];
+  char* next = nullptr;
+  if (!NextNumber(p, end, number)) {
+    return false;
+  }
+  long long word_num = strtoll(number, &next, 10);
+  if (*next != '\0' || !NextNumber(p, end, number)) {
+    return false;
+  }
+  dim_ = strtol(number, &next, 10);
+  if (*next != '\0' || word_num <= 0 || dim_ <= 0 || p >= end) {
+    return false;
+  }
+
+  words_.reserve(word_num);
+  word2pos_.reserve(word_num);
+  matrix_.resize(static_cast<size_t>(word_num) * dim_);
+  for (long long i = 0; i < word_num; ++i) {
+    skip_space();
+    const char* word_begin = p;
+    while (p < end && *p != ' ') {
+      ++p;
+    }
+    if (p >= end) {
+      return false;
+    }
+    words_.emplace_back(word_begin, p - word_begin);
+    ++p;  // the space after word
+
+    real* row = &matrix_[i * dim_];
+    if (binary_format) {
+      if (end - p < static_cast<long long>(dim_ * sizeof(real))) {
+        return false;
+      }
+      memcpy(row, p, dim_ * sizeof(real));
+      p += dim_ * sizeof(real);
+    } else {
+      for (int j = 0; j < dim_; ++j) {
+        if (!NextNumber(p, end, number)) {
+          return false;
+        }
+        row[j] = strtof(number, &next);
+        if (*next != '\0') {
+          return false;
+        }
+      }
+    }
+    Normalize(row, dim_);
+    word2pos_[words_.back()] = i;
+  }
+
+  return true;
+}
+
+bool WordVecModel::ParseMapped(const char* data, size_t size) {
+  MappedModelHeader header;
+  memcpy(&header, data, sizeof(header));
+  dim_ = header.dim;
+  const size_t matrix_size = header.rows * header.dim * sizeof(real);
+  if (header.rows == 0 || dim_ <= 0 ||
+      header.matrix_offset + matrix_size > header.words_offset ||
+      header.words_offset > size) {
+    return false;
+  }
+
+  const char* p = data + header.words_offset;
+  const char* end = data + size;
+  const real* vectors = reinterpret_cast<const real*>(data + header.matrix_offset);
+  words_.reserve(header.rows);
+  word2pos_.reserve(header.rows);
+  matrix_.assign(vectors, vectors + header.rows * header.dim);
+  for (size_t i = 0; i < header.rows; ++i) {
+    const char* word_end = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (word_end == nullptr) {
+      return false;
+    }
+    words_.emplace_back(p, word_end - p);
+    p = word_end + 1;
+    Normalize(&matrix_[i * dim_], dim_);
+    word2pos_[words_.back()] = i;
+  }
+
+  return true;
+}
+
+int WordVecModel::GetWordIndex(const string &word) const {
+  auto iter = word2pos_.find(word);
+  if (iter == word2pos_.end()) {
+    return -1;
+  }
+
+  return iter->second;
+}
+
+const real* WordVecModel::GetVector(const string &word) const {
+  int idx = GetWordIndex(word);
+  if (idx < 0) {
+    if (buckets_.empty()) {
+      return nullptr;
+    }
+    // hashed the same way as CorpusReader did in training
+    const size_t bucket = HashWord(word) % BucketNum();
+    return &buckets_[bucket * dim_];
+  }
+
+  return GetVector(idx);
+}
+
+bool WordVecModel::Similarity(const string &a, const string &b,
+                              real &score) const {
+  const real* va = GetVector(a);
+  const real* vb = GetVector(b);
+  if (va == nullptr || vb == nullptr) {
+    return false;
+  }
+  score = Dot(va, vb, dim_);
+
+  return true;
+}
+
+void WordVecModel::Nearest(const real query[], int k, const vector<int> &exclude,
+                           vector<Neighbor> &result) const {
+  vector<real> unit(query, query + dim_);
+  Normalize(&unit[0], dim_);
+
+  result.clear();
+  if (k <= 0) {
+    return;
+  }
+  result.reserve(k + 1);
+  for (int i = 0; i < Size(); ++i) {
+    const real score = Dot(&unit[0], GetVector(i), dim_);
+    if (result.size() == k && score <= result.front().score) {
+      continue;
+    }
+    if (!Excluded(exclude, i)) {
+      PushNeighbor(result, k, i, score);
+    }
+  }
+  sort_heap(result.begin(), result.end());
+}
+
+bool WordVecModel::MostSimilar(const string &word, int k,
+                               vector<Neighbor> &result) const {
+  const real* vec = GetVector(word);
+  if (vec == nullptr) {
+    return false;
+  }
+  // a word out of the model has no row of its own to skip
+  const int idx = GetWordIndex(word);
+  Nearest(vec, k, idx < 0 ? vector<int>() : vector<int>(1, idx), result);
+
+  return true;
+}
+
+bool WordVecModel::AnalogyQuery(const string &a, const string &b,
+                                const string &c, vector<real> &query,
+                                vector<int> &exclude) const {
+  const int ia = GetWordIndex(a);
+  const int ib = GetWordIndex(b);
+  const int ic = GetWordIndex(c);
+  if (ia < 0 || ib < 0 || ic < 0) {
+    return false;
+  }
+  const real* va = GetVector(ia);
+  const real* vb = GetVector(ib);
+  const real* vc = GetVector(ic);
+  query.resize(dim_);
+  for (int i = 0; i < dim_; ++i) {
+    query[i] = va[i] - vb[i] + vc[i];
+  }
+  Normalize(&query[0], dim_);
+  exclude = {ia, ib, ic};
+
+  return true;
+}
+
+bool WordVecModel::Analogy(const string &a, const string &b, const string &c,
+                           int k, vector<Neighbor> &result) const {
+  vector<real> query;
+  vector<int> exclude;
+  if (!AnalogyQuery(a, b, c, query, exclude)) {
+    return false;
+  }
+  Nearest(&query[0], k, exclude, result);
+
+  return true;
+}
+
+void WordVecModel::NearestBatch(const vector<real> &queries, int k,
+                                const vector<vector<int> > &excludes,
+                                vector<vector<Neighbor> > &results) const {
+  const int query_num = queries.size() / dim_;
+  CHECK_EQ(excludes.size(), query_num);
+  results.assign(query_num, vector<Neighbor>());
+  if (k <= 0) {
+    return;
+  }
+
+  vector<real> units(queries);
+  for (int q = 0; q < query_num; ++q) {
+    Normalize(&units[static_cast<size_t>(q) * dim_], dim_);
+  }
+
+  // every thread owns a group of queries and streams the whole matrix
+  // through cache once for the group
+  const int group_num = (query_num + kQueryBlock - 1) / kQueryBlock;
+#pragma omp parallel for schedule(dynamic)
+  for (int g = 0; g < group_num; ++g) {
+    const int q_begin = g * kQueryBlock;
+    const int q_end = min(query_num, q_begin + kQueryBlock);
+    real scores[kRowBlock];
+    for (int r_begin = 0; r_begin < Size(); r_begin += kRowBlock) {
+      const int r_end = min<int>(Size(), r_begin + kRowBlock);
+      for (int q = q_begin; q < q_end; ++q) {
+        const real* query = &units[static_cast<size_t>(q) * dim_];
+        for (int r = r_begin; r < r_end; ++r) {
+          scores[r - r_begin] = Dot(query, GetVector(r), dim_);
+        }
+        vector<Neighbor> &heap = results[q];
+        for (int r = r_begin; r < r_end; ++r) {
+          const real score = scores[r - r_begin];
+          if (heap.size() == k && score <= heap.front().score) {
+            continue;
+          }
+          if (!Excluded(excludes[q], r)) {
+            PushNeighbor(heap, k, r, score);
+          }
+        }
+      }
+    }
+    for (int q = q_begin; q < q_end; ++q) {
+      sort_heap(results[q].begin(), results[q].end());
+    }
+  }
+}
@@ -0,0 +1,130 @@
+/*
+ * wordvec_model.h
+ *
+ * In-process query library over a trained word vector model
+ */
+
+#ifndef WORDVEC_MODEL_H_
+#define WORDVEC_MODEL_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+// A word in query result and its cosine similarity with the query
+struct Neighbor {
+  int index;
+  real score;
+
+  Neighbor(int index, real score) : index(index), score(score) {
+  }
+
+  // higher score first
+  bool operator <(const Neighbor &rhs) const {
+    return score > rhs.score;
+  }
+};
+
+// Word vectors loaded from a model saved by WordVec::SaveVector. The model
+// is immutable after loading, so all the queries are const and can be issued
+// from any number of threads concurrently without locking.
+class WordVecModel {
+ public:
+  virtual ~WordVecModel();
+
+  // Load model file, return nullptr on failure. Mapped model files written
+  // with -mmap_tables are recognized by their header, binary_format is
+  // ignored for them. The hash buckets saved next to file with
+  // -hash_buckets are loaded too if they exist.
+  static WordVecModel* Load(const std::string &file, bool binary_format = true);
+
+  // Load the hash bucket rows of the words out of the model, they have to
+  // be of the model's dimension
+  bool LoadBuckets(const std::string &file, bool binary_format = true);
+
+  int BucketNum() const {
+    return dim_ > 0 ? buckets_.size() / dim_ : 0;
+  }
+
+  size_t Size() const {
+    return words_.size();
+  }
+
+  int Dimension() const {
+    return dim_;
+  }
+
+  int GetWordIndex(const std::string &word) const;
+
+  const std::string& GetWord(int index) const {
+    return words_[index];
+  }
+
+  // The unit length vector of word, nullptr if it is not in the model.
+  // With hash buckets loaded a word out of the model gets the vector of its
+  // bucket instead.
+  const real* GetVector(const std::string &word) const;
+
+  const real* GetVector(int index) const {
+    return &matrix_[static_cast<size_t>(index) * dim_];
+  }
+
+  // Cosine similarity of two words, return false if any has no vector
+  bool Similarity(const std::string &a, const std::string &b, real &score) const;
+
+  // Top k words closest to query vector by cosine similarity, skipping the
+  // words in exclude. query does not need to be normalized.
+  void Nearest(const real query[], int k, const std::vector<int> &exclude,
+               std::vector<Neighbor> &result) const;
+
+  // Top k neighbours of word, return false if it has no vector
+  bool MostSimilar(const std::string &word, int k,
+                   std::vector<Neighbor> &result) const;
+
+  // Top k words closest to a - b + c, return false if any word is not in
+  // the model
+  bool Analogy(const std::string &a, const std::string &b,
+               const std::string &c, int k,
+               std::vector<Neighbor> &result) const;
+
+  // Build the normalized analogy vector a - b + c into query
+  bool AnalogyQuery(const std::string &a, const std::string &b,
+                    const std::string &c, std::vector<real> &query,
+                    std::vector<int> &exclude) const;
+
+  // Answer many Nearest queries at once. The matrix is scanned block by
+  // block and every block is scored against a group of queries while it is
+  // in cache, instead of one full scan per query. queries holds
+  // Dimension() values per query.
+  void NearestBatch(const std::vector<real> &queries, int k,
+                    const std::vector<std::vector<int> > &excludes,
+                    std::vector<std::vector<Neighbor> > &results) const;
+
+ private:
+  WordVecModel();
+
+  WordVecModel(const WordVecModel&);  // no copying!
+
+  void operator=(const WordVecModel&);  // no copying!
+
+  bool Parse(const char* data, size_t size, bool binary_format);
+
+  // parse the mapped model format, see mapped_table.h
+  bool ParseMapped(const char* data, size_t size);
+
+  std::vector<std::string> words_;
+
+  std::unordered_map<std::string, int> word2pos_;
+
+  // Size() x dim_ unit length vectors, row major
+  std::vector<real> matrix_;
+
+  // BucketNum() x dim_ unit length vectors of the hash buckets
+  std::vector<real> buckets_;
+
+  int dim_;
+};
+
+#endif // wordvec_model.h
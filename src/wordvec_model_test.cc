@@ -0,0 +1,227 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "mapped_table.h"
+#include "model_delta.h"
+#include "test_util.h"
+#include "utils.h"
+#include "wordvec_model.h"
+
+using namespace std;
+
+namespace {
+const char kModelFile[] = "wordvec_model_test.bin";
+} // namespace
+
+TEST(TestWordVecModel, TestLoad) {
+  unique_ptr<WordVecModel> model = LoadTestModel(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+  ASSERT_EQ(5, model->Size());
+  ASSERT_EQ(3, model->Dimension());
+  ASSERT_EQ(1, model->GetWordIndex("queen"));
+  ASSERT_EQ(-1, model->GetWordIndex("pear"));
+  ASSERT_TRUE(model->GetVector("pear") == nullptr);
+
+  real score = 0;
+  ASSERT_TRUE(model->Similarity("king", "king", score));
+  ASSERT_NEAR(1.0, score, 1e-6);
+  ASSERT_TRUE(model->Similarity("man", "woman", score));
+  ASSERT_NEAR(0.0, score, 1e-6);
+}
+
+TEST(TestWordVecModel, TestLoadText) {
+  // the last number runs to the end of file, with no newline after it
+  const string text = "2 2\nking 1 0\nqueen 0 0.5";
+  for (size_t size : {text.size(), text.size() - 4, size_t(1)}) {
+    {
+      FILE* fo = fopen(kModelFile, "wb");
+      FileCloser fcloser(fo);
+      fwrite(text.data(), 1, size, fo);
+    }
+    unique_ptr<WordVecModel> model(WordVecModel::Load(kModelFile, false));
+    remove(kModelFile);
+    if (size < text.size()) {
+      // cut inside the vectors or the header
+      ASSERT_TRUE(model == nullptr) << size;
+      continue;
+    }
+    ASSERT_TRUE(model != nullptr);
+    ASSERT_EQ(2, model->Size());
+    ASSERT_NEAR(1.0, model->GetVector("queen")[1], 1e-6);
+  }
+}
+
+TEST(TestWordVecModel, TestQueries) {
+  unique_ptr<WordVecModel> model = LoadTestModel(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+
+  vector<Neighbor> result;
+  ASSERT_TRUE(model->MostSimilar("king", 2, result));
+  ASSERT_EQ(2, result.size());
+  ASSERT_GE(result[0].score, result[1].score);
+  ASSERT_NE(model->GetWordIndex("king"), result[0].index);
+
+  // king - man + woman = queen
+  ASSERT_TRUE(model->Analogy("king", "man", "woman", 1, result));
+  ASSERT_EQ(1, result.size());
+  ASSERT_EQ("queen", model->GetWord(result[0].index));
+  ASSERT_FALSE(model->Analogy("king", "man", "pear", 1, result));
+}
+
+TEST(TestWordVecModel, TestNearestBatch) {
+  unique_ptr<WordVecModel> model = LoadTestModel(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+
+  vector<real> queries;
+  vector<vector<int> > excludes;
+  for (int i = 0; i < model->Size(); ++i) {
+    const real* vec = model->GetVector(i);
+    queries.insert(queries.end(), vec, vec + model->Dimension());
+    excludes.push_back(vector<int>(1, i));
+  }
+  vector<vector<Neighbor> > results;
+  model->NearestBatch(queries, 3, excludes, results);
+  ASSERT_EQ(model->Size(), results.size());
+  for (int i = 0; i < model->Size(); ++i) {
+    vector<Neighbor> expected;
+    model->Nearest(model->GetVector(i), 3, excludes[i], expected);
+    ASSERT_EQ(expected.size(), results[i].size());
+    for (int j = 0; j < expected.size(); ++j) {
+      ASSERT_NEAR(expected[j].score, results[i][j].score, 1e-6);
+    }
+  }
+}
+
+TEST(TestWordVecModel, TestLoadMapped) {
+  // header page, the matrix, then the words as written with -mmap_tables
+  const vector<real> vectors = {3, 4, 0, 0, 0, 2};
+  MappedModelHeader header;
+  memcpy(header.magic, kMappedModelMagic, sizeof(header.magic));
+  header.rows = 2;
+  header.dim = 3;
+  header.matrix_offset = 4096;
+  header.words_offset = header.matrix_offset + vectors.size() * sizeof(real);
+  {
+    FILE* fo = fopen(kModelFile, "wb");
+    FileCloser fcloser(fo);
+    vector<char> page(header.matrix_offset, 0);
+    memcpy(&page[0], &header, sizeof(header));
+    fwrite(&page[0], 1, page.size(), fo);
+    fwrite(&vectors[0], sizeof(real), vectors.size(), fo);
+    fprintf(fo, "first\nsecond\n");
+  }
+  unique_ptr<WordVecModel> model(WordVecModel::Load(kModelFile));
+  remove(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+  ASSERT_EQ(2, model->Size());
+  ASSERT_EQ(3, model->Dimension());
+  ASSERT_EQ(1, model->GetWordIndex("second"));
+  ASSERT_NEAR(0.6, model->GetVector("first")[0], 1e-6);
+  ASSERT_NEAR(1.0, model->GetVector("second")[2], 1e-6);
+}
+
+TEST(TestWordVecModel, TestApplyDelta) {
+  WriteTestModel(kModelFile, {"king", "queen"}, {{1, 0, 0}, {0, 1, 0}});
+  const char delta_file[] = "wordvec_model_test.delta";
+  {
+    // queen changes and apple is new
+    FILE* fo = fopen(delta_file, "wb");
+    FileCloser fcloser(fo);
+    fprintf(fo, "%s 3 2\n", kModelDeltaMagic);
+    const real queen[] = {0, 0, 1}, apple[] = {-1, 0, 0};
+    fprintf(fo, "queen ");
+    fwrite(queen, sizeof(real), 3, fo);
+    fprintf(fo, "\napple ");
+    fwrite(apple, sizeof(real), 3, fo);
+    fprintf(fo, "\n");
+  }
+  ASSERT_TRUE(ApplyModelDelta(kModelFile, delta_file));
+  remove(delta_file);
+  unique_ptr<WordVecModel> model(WordVecModel::Load(kModelFile));
+  remove(kModelFile);
+  ASSERT_TRUE(model != nullptr);
+  ASSERT_EQ(3, model->Size());
+  ASSERT_NEAR(1.0, model->GetVector("king")[0], 1e-6);
+  ASSERT_NEAR(1.0, model->GetVector("queen")[2], 1e-6);
+  ASSERT_NEAR(-1.0, model->GetVector("apple")[0], 1e-6);
+}
+
+TEST(TestWordVecModel, TestApplyDeltaToTextModel) {
+  const string text = "5 3\nking 1 1 0\nqueen 1 0 1\nman 0 1 0\n"
+      "woman 0 0 1\napple -1 0 0\n";
+  {
+    FILE* fo = fopen(kModelFile, "wb");
+    FileCloser fcloser(fo);
+    fwrite(text.data(), 1, text.size(), fo);
+  }
+  const char delta_file[] = "wordvec_model_test.delta";
+  {
+    FILE* fo = fopen(delta_file, "wb");
+    FileCloser fcloser(fo);
+    fprintf(fo, "%s 3 1\n", kModelDeltaMagic);
+    const real queen[] = {0, 0, 1};
+    fprintf(fo, "queen ");
+    fwrite(queen, sizeof(real), 3, fo);
+    fprintf(fo, "\n");
+  }
+  // a text model is rejected and left as it is
+  ASSERT_FALSE(ApplyModelDelta(kModelFile, delta_file));
+  remove(delta_file);
+  string content(text.size() + 1, '\0');
+  FILE* fi = fopen(kModelFile, "rb");
+  content.resize(fread(&content[0], 1, content.size(), fi));
+  fclose(fi);
+  remove(kModelFile);
+  ASSERT_EQ(text, content);
+}
+
+TEST(TestWordVecModel, TestHashBuckets) {
+  WriteTestModel(kModelFile, {"king", "queen"}, {{1, 0, 0}, {0, 1, 0}});
+  const string bucket_file = string(kModelFile) + kBucketFileSuffix;
+  WriteTestModel(bucket_file, {"bucket_0", "bucket_1"},
+                 {{0, 0, 2}, {0, 3, 3}});
+  unique_ptr<WordVecModel> model(WordVecModel::Load(kModelFile));
+  remove(kModelFile);
+  remove(bucket_file.c_str());
+  ASSERT_TRUE(model != nullptr);
+  ASSERT_EQ(2, model->Size());
+  ASSERT_EQ(2, model->BucketNum());
+  ASSERT_EQ(-1, model->GetWordIndex("pear"));
+
+  // pick unseen words hashed to each bucket
+  string even, odd;
+  for (int i = 0; i < 100 && (even.empty() || odd.empty()); ++i) {
+    const string word = "w" + to_string(i);
+    (HashWord(word) % 2 == 0 ? even : odd) = word;
+  }
+  ASSERT_FALSE(even.empty());
+  ASSERT_FALSE(odd.empty());
+
+  // an unseen word gets the normalized vector of its bucket
+  const real* vec = model->GetVector(even);
+  ASSERT_TRUE(vec != nullptr);
+  ASSERT_NEAR(0.0, vec[1], 1e-6);
+  ASSERT_NEAR(1.0, vec[2], 1e-6);
+  vec = model->GetVector(odd);
+  ASSERT_TRUE(vec != nullptr);
+  ASSERT_NEAR(sqrt(0.5), vec[1], 1e-6);
+  ASSERT_NEAR(sqrt(0.5), vec[2], 1e-6);
+  ASSERT_NEAR(1.0, model->GetVector("king")[0], 1e-6);
+
+  vector<Neighbor> result;
+  ASSERT_TRUE(model->MostSimilar("pear", 2, result));
+  ASSERT_EQ(2, result.size());
+  real score = 0;
+  ASSERT_TRUE(model->Similarity("pear", "pear", score));
+  ASSERT_NEAR(1.0, score, 1e-6);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}